@@ -19,19 +19,53 @@ const int defaultHistorySize = 10;
 
 //between file redirection and piping, there's a decent chance we will lose std in or out between runs
 //these global constants are used to save both
-const int STDIN_COPY = dup(STDIN_FILENO);
-const int STDOUT_COPY = dup(STDOUT_FILENO);
+//F_DUPFD_CLOEXEC so the copies aren't inherited by every linux command
+const int STDIN_COPY = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+const int STDOUT_COPY = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
 
 int main(int argc, const char * argv[])
 {
-    Shell currentShell(defaultName, defaultDelim, defaultAliasSize, defaultHistorySize);
+    //with -c or a script name, or when stdin isn't a terminal, the shell runs in batch mode
+    //batch mode reads the commands without prompting, stops at the first error like a script does, and exits with the last command's status
+    bool batch = (argc > 1 || !isatty(STDIN_FILENO));
+    int batchFD = STDIN_FILENO;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        if (argc != 3)
+        {
+            std::cerr << "usage: " << argv[0] << " [-c commands | script]\n";
+            return 2;
+        }
+        batchFD = -1;
+    }
+    else if (argc > 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [-c commands | script]\n";
+        return 2;
+    }
+    else if (argc == 2)
+    {
+        batchFD = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (batchFD == -1)
+        {
+            perror(argv[1]);
+            return 127;
+        }
+    }
+    
+    Shell currentShell(defaultName, defaultDelim, defaultAliasSize, defaultHistorySize, batch);
+    if (batch && batchFD == -1)
+        currentShell.setBatchCommand(argv[2]);
+    else if (batch)
+        currentShell.setBatchInput(batchFD);
     
     //infinite loop, since exit conditions are handled internally
     while (true)
     {
         try
         {
-            currentShell.run();
+            if (!currentShell.run())
+                return batch ? currentShell.getExitStatus() : 0; //normal exit
         }
         catch (error const &e)
         {
@@ -39,92 +73,17 @@ int main(int argc, const char * argv[])
             dup2(STDIN_COPY, STDIN_FILENO);
             dup2(STDOUT_COPY, STDOUT_FILENO);
             
-            switch (e.errorCode)
+            if (!printError(e.errorCode))
             {
-                case RETURNCODE::EXIT:
-                    return 0; //normal exit
-                    
-                case RETURNCODE::TOO_FEW_ARGS:
-                    std::cout << "Too few arguments\n";
-                    break;
-                    
-                case RETURNCODE::TOO_MANY_ARGS:
-                    std::cout << "Too many arguments\n";
-                    break;
-                    
-                case RETURNCODE::INVALID_ARG:
-                    std::cout << "Invalid argument\n";
-                    break;
-                    
-                case RETURNCODE::NO_HISTORY:
-                    std::cout << "Requested line of history does not exist\n";
-                    break;
-                    
-                case RETURNCODE::NO_ALIAS:
-                    std::cout << "Alias not found\n";
-                    break;
-                    
-                case RETURNCODE::NO_OVERRIDE:
-                    std::cout << "Cannot override default commands\n";
-                    break;
-                    
-                case RETURNCODE::RECURSIVE_ALIAS:
-                    std::cout << "Alias is recursive; unable to resolve\n";
-                    break;
-                    
-                case RETURNCODE::FILE_ERROR:
-                    std::cout << "Unable to open file\n";
-                    break;
-                    
-                case RETURNCODE::NO_DELETE:
-                    std::cout << "rm command disabled for safety\n";
-                    break;
-                    
-                case RETURNCODE::BAD_FORMAT:
-                    std::cout << "Alias file is in incorrect format\n";
-                    break;
-                    
-                case RETURNCODE::COMMAND_DNE:
-                    std::cout << "Command does not exist\n";
-                    break;
-                    
-                case RETURNCODE::NO_JOB:
-                    std::cout << "No job exists with that ID\n";
-                    break;
-                    
-                case RETURNCODE::BAD_SYNTAX:
-                    std::cout << "Invalid syntax\n";
-                    break;
-                    
-                case RETURNCODE::PROCESS_ERROR:
-                    perror("Error in child process");
-                    break;
-                    
-                case RETURNCODE::CMD_NOT_FOUND:
-                    std::cout << "Linux command not found\n";
-                    break;
-                    
-                case RETURNCODE::RECURSIVE_SCRIPT:
-                    std::cout << "Recursion in script.  Exiting script mode\n";
-                    break;
-                    
-                case RETURNCODE::OUTPUT_COMMAND:
-                    //not really an error, like EXIT it just signals that the current cycle is finished
-                    break;
-                    
-                case RETURNCODE::RECURSIVE_REDIRECTION:
-                    std::cout << "Cannot read and write to the same file\n";
-                    break;
-                    
-                default:
-                    std::cout << "Uncaught exception " << (int) e.errorCode << "\nQuitting\n";
-                    return (int) e.errorCode;
+                std::cout << "Uncaught exception " << (int) e.errorCode << "\nQuitting\n";
+                return (int) e.errorCode;
             }
+            if (batch)
+                return 1;
         }
         //regardless of exit status of last command, the shell must be cleared before the next loop
+        //stdin and stdout are only put back after an error, since commands that finish normally never leave them changed
         currentShell.reset();
-        dup2(STDIN_COPY, STDIN_FILENO);
-        dup2(STDOUT_COPY, STDOUT_FILENO);
     }
     return 0;
 }
@@ -3,14 +3,19 @@
 
 #include "shell.hpp"
 
+int Shell::sigchldPipe[2] = {-1, -1};
+
 //INITLIAZATION FUNCTIONS
 //set up variables, default values
 //Does not throw exceptions
-Shell::Shell(std::string defaultName, std::string defaultDelim, int aliasSize, int historySize)
+Shell::Shell(std::string defaultName, std::string defaultDelim, int aliasSize, int historySize, bool batch)
 {
     //reads startup values from config.ini if it exists; if not this file will be created later
-    std::ifstream configFile("config.ini");
-    if (!configFile)
+    //batch mode never prompts, so it leaves config.ini alone
+    std::ifstream configFile;
+    if (!batch)
+        configFile.open("config.ini");
+    if (!configFile.is_open())
     {
         shellName = defaultName;
         shellDelimiter = defaultDelim;
@@ -26,1285 +31,3960 @@ Shell::Shell(std::string defaultName, std::string defaultDelim, int aliasSize, i
     maxHistorySize = historySize;
     NOHISTORYFLAG = false;
     
-    //setting up the map from the name of commands to the address of the static function they should run
-    commandMap =
-    {
-        {functionPair("setshellname", &staticSetShellName)},
-        {functionPair("setterminator", &staticSetShellDelimiter)},
-        {functionPair("history", &staticPrintHistory)},
-        {functionPair("newname", &staticNewnameCommand)},
-        {functionPair("newnames", &staticPrintAliases)},
-        {functionPair("savenewnames", &staticSaveNewAliasFile)},
-        {functionPair("readnewnames", &staticReadAliasFile)},
-        {functionPair("man", &staticInfoCommand)},
-        {functionPair("stop", &staticExit)},
-        {functionPair("backjobs", &staticPrintBGJobs)},
-        {functionPair("frontjob", &staticBringJobToFG)},
-        {functionPair("cond", &staticCondExec)},
-        {functionPair("notcond", &staticReverseCondExec)},
-        {functionPair("cull", &staticCull)},
-        {functionPair("usescript", &staticUsescript)},
-        {functionPair("output", &staticOutput)}
-    };
+    //the history file isn't opened or read until it is needed
+    const char* home = getenv("HOME");
+    historyFileName = (home != NULL) ? std::string(home) + "/" + HISTORY_FILE_NAME : HISTORY_FILE_NAME;
+    historyFD = -1;
+    historyMap = NULL;
+    historyMapSize = 0;
+    historyIndexedSize = 0;
+    historyPending = false;
+    historyRing.resize(maxHistorySize);
+    historyHead = 0;
+    historyCount = 0;
     
+    spawnMode = true;
+    utilityMode = true;
+    currentCompiled = NULL;
+    currentTree = NULL;
+    aliasGeneration = 0;
     backgroundMode = false;
+    exitStatus = 0;
+    stopRequested = false;
+    batchMode = batch;
+    batchFD = -1;
+    batchStart = 0;
+    batchEnd = 0;
     bgJobCount = 0;
     
-    infoMap =
-    {
-        {std::pair<std::string, std::string>("setshellname", SETSHELLINFO)},
-        {std::pair<std::string, std::string>("setterminator", SETDELIMINFO)},
-        {std::pair<std::string, std::string>("history", HISTORYINFO)},
-        {std::pair<std::string, std::string>("newname", NEWNAMEINFO)},
-        {std::pair<std::string, std::string>("savenewnames", SAVEALIASINFO)},
-        {std::pair<std::string, std::string>("readnewnames", READALIASINFO)},
-        {std::pair<std::string, std::string>("newnames", PRINTALIASINFO)},
-        {std::pair<std::string, std::string>("frontjob", FRONTJOBINFO)},
-        {std::pair<std::string, std::string>("backjobs", BACKJOBINFO)},
-        {std::pair<std::string, std::string>("cond", CONDINFO)},
-        {std::pair<std::string, std::string>("notcond", CONDINFO)},
-        {std::pair<std::string, std::string>("!", REPLACEHISTINFO)}
-    };
+    //background children are reaped as soon as they finish rather than whenever backjobs happens to be run
+    //the handler only writes to the self-pipe, which the shell polls while it waits at the prompt or on foreground commands, so exits are collected straight away
+    //SA_RESTART so that the signal doesn't interrupt reading the command line or waiting on foreground commands
+    //stopped children send it too, since a stop doesn't show up on a pidfd
+    pipe2(sigchldPipe, O_CLOEXEC | O_NONBLOCK);
+    childSignalled = false;
+    runningAsStage = false;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sigchldHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &action, NULL);
+    
+    //job control is only for an interactive shell on a terminal
+    //the shell waits until it is in the foreground, then puts itself in its own process group and takes the terminal
+    //it ignores ctrl-c, ctrl-\ and ctrl-z, which are meant for the foreground job, and the signals for using the terminal from the background,
+    //which is where it is whenever it takes the terminal back
+    jobControl = !batch && isatty(STDIN_FILENO);
+    shellPGID = getpgrp();
+    if (jobControl)
+    {
+        while (tcgetpgrp(STDIN_FILENO) != (shellPGID = getpgrp()))
+            kill(-shellPGID, SIGTTIN);
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        //this fails if the shell is already a session leader, in which case it already has its own group
+        setpgid(0, 0);
+        shellPGID = getpgrp();
+        tcsetpgrp(STDIN_FILENO, shellPGID);
+        tcgetattr(STDIN_FILENO, &shellModes);
+    }
 }
 
 //HELPER FUNCTIONS
-//readies the shell for the next line of input
-//called after all commands, whether successful or not
-//currently only requires resetting the tokenList, since currentLine gets overwritten every time
-void Shell::reset()
+//converts the times used in job accounting into seconds
+double timevalSeconds(const struct timeval& t)
 {
-    tokenList.clear();
-    backgroundMode = false;
-    return;
+    return t.tv_sec + t.tv_usec / 1000000.0;
 }
 
-void Shell::staticSetShellName(Shell* s)
+double elapsedSeconds(const struct timespec& start, const struct timespec& end)
 {
-    s->setShellName();
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
 }
 
-//sets the shell name to the everything after the first token
-//throws TOO_FEW_ARGS if there are not at least 2 tokens
-//note that shell name is allowed to be multiple words, with spaces
-void Shell::setShellName()
+//FNV-1a, used as the checksum of a binary alias snapshot
+//and, starting from a different basis, as the hash of the builtin table, which is why it has to work at compile time
+constexpr uint32_t fnv1aChecksum(const char* data, size_t length, uint32_t basis = 2166136261u)
 {
-    if (tokenList.size() < 1)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    else
+    uint32_t hash = basis;
+    for (size_t i = 0; i < length; i++)
     {
-        std::string newName = tokenList[1];
-        for (int i = 2; i < tokenList.size(); i++)
-            newName = newName + " " + tokenList[i];
-        shellName = newName;
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
     }
-    
-    std::ofstream configFile("config.ini", std::ios::trunc);
-    configFile << shellName << " " << shellDelimiter;
-    configFile.close();
-    return;
+    return hash;
 }
 
-void Shell::staticSetShellDelimiter(Shell* s)
-{
-    s->setShellDelimiter();
-}
-
-//sets delim to the second token
-//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there are not exactly two tokens
-//unlike shell name, I decided the delimiter should only be one "word"
-void Shell::setShellDelimiter()
+//returns the length of the ; && or || starting at line[i], or 0 if there isn't one
+//these separate words even without blanks around them, like in other shells
+size_t listOperatorLength(const std::string& line, size_t i)
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    std::string newDelim = tokenList[1];
-    shellDelimiter = newDelim;
-    
-    std::ofstream configFile("config.ini", std::ios::trunc);
-    configFile << shellName << " " << shellDelimiter;
-    configFile.close();
-    
-    return;
+    if (line[i] == ';')
+        return 1;
+    if (i + 1 < line.size() && (line[i] == '&' || line[i] == '|') && line[i + 1] == line[i])
+        return 2;
+    return 0;
 }
 
-//replaces "! #" commands with the specified line of history
-//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there are not exactly two arguments
-//throws INVALID_ARG if stoi function returns an error (meaning it wasn't able to convert the argument to int)
-//throws NO_HISTORY if that line of history doesn't exist
-void Shell::replaceWithHistory()
+//true if line[i] starts a comment, ie it is a $ that isn't part of $?
+bool startsComment(const std::string& line, size_t i)
 {
-    //parse everything out
-    std::deque<std::string> tempArray;
-    tokenizeString(currentLine, &tempArray);
-    
-    
-    if (tempArray.size() < 2)
-    {
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    }
-    else if (tempArray.size() > 2)
-    {
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    }
-    
-    int index;
-    
-    try {
-        //can either throw invalid_argument or out_of_range exception
-        //I treat both the same
-        index = stoi(tempArray[1]);
-    }
-    catch (std::exception &e)
-    {
-        throw error(RETURNCODE::INVALID_ARG);
-    }
-    
-    
-    //check to see if that line of history exists
-    if (historyList.size() < index || index <= 0)
-    {
-        throw error(RETURNCODE::NO_HISTORY);
-    }
-    else
-    {
-        //note index - 1, to compensate between standard counting starting at 1, and the historyList indexing which of course begins at 0
-        currentLine = historyList[index - 1];
-    }
-    return;
+    return line[i] == '$' && !(i + 1 < line.size() && line[i + 1] == '?');
 }
 
-//increments the job count, creates the job, adds to the job map
-void Shell::addJobToBGQueue(std::vector<pid_t> childList)
+//the blanks that separate words, the same ones istringstream skips
+bool isBlank(char c)
 {
-    bgJobCount++;
-    bgJob job(bgJobCount, childList, currentLine, time(NULL));
-    bgJobQueue.insert(std::pair<int, bgJob>(bgJobCount, job));
-    return;
+    return c == ' ' || c == '\t' || c == '\v' || c == '\n' || c == '\r' || c == '\f';
 }
 
-//evaluates conditions in three formats:
-// ( condition file ) returns 1 if true, -1 if false
-// (condition file) returns 2 if true, -2 if false
-// condition file returns 3 if true, -3 if false
-// throws BAD_SYNTAX if it cannot detect one of these three formats
-int Shell::condChecker()
+//the lexer: strips a $ comment (if stripComments is set), trims the line and splits it into words, all in one pass over line
+//single quotes keep everything up to the next single quote as is, double quotes do the same except that \" \\ and \$ are escapes,
+//and outside quotes a backslash makes the next character an ordinary one
+//each word goes into lexed.arena with its quoting removed, and lexed.tokens gets a view of it there
+//lexed.text gets each word exactly as written, one space apart
+//an unquoted ; && or || is always a word of its own
+//nothing the lexer writes is longer than line, so reserving that up front means arena can't move and leave the views dangling
+//everything is cleared rather than replaced, so once lexed is big enough the lexer itself allocates nothing
+//the words do still get one copy each when setTokens puts them in tokenList, since commands and compiled lines outlive lexed
+//throws BAD_SYNTAX for an unterminated quote or a backslash at the end of the line
+void lexLine(const std::string& line, lexedLine& lexed, bool stripComments)
 {
-    /*each format actually has a different length for the condition section
-     format 1 has a minimum of 5:
-     cond ( condition file ) //note that this is technically an invalid command, since nothing follows the condition, but we can ignore that here
-     formats 2 and 3 have a minimum of 3:
-     cond condition file
-     or
-     cond (condition file)
-     */
-    
-    if (tokenList.size() < 3)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
+    lexed.text.clear();
+    lexed.arena.clear();
+    lexed.tokens.clear();
+    lexed.quoted.clear();
+    lexed.text.reserve(line.size());
+    lexed.arena.reserve(line.size());
     
-    int format;
-    struct stat fileStruct;
-    std::string condCode;
-    if (tokenList[1] == "(")
-    {
-        if (tokenList.size() < 5)
-            throw error(RETURNCODE::TOO_FEW_ARGS);
-        
-        if (tokenList[4] != ")")
-            throw error(RETURNCODE::BAD_SYNTAX);
-        
-        stat(tokenList[3].c_str(), &fileStruct);
-        condCode = tokenList[2];
-        format = 1;
-    }
-    else if (tokenList[1][0] == '(')
+    size_t i = 0, length = line.size();
+    while (i < length)
     {
-        if (tokenList[2].back() != ')')
-            throw error(RETURNCODE::BAD_SYNTAX);
+        //skip blanks up to the next word
+        while (i < length && isBlank(line[i]))
+            i++;
+        if (i == length || (stripComments && startsComment(line, i)))
+            break;
         
-        std::string file = tokenList[2];
-        file.pop_back(); //to delete the ) character from the end
-        stat(file.c_str(), &fileStruct);
-        condCode = tokenList[1];
-        condCode.erase(0, 1); //cutting off the ( character
-        format = 2;
-    }
-    else
-    {
-        if (tokenList[3] == ")" || tokenList[2].back() == ')')
+        if (!lexed.text.empty())
+            lexed.text.push_back(' ');
+        size_t wordStart = i, start = lexed.arena.size();
+        bool quoted = false;
+        char quote = 0; //the quote character the lexer is inside, 0 if none
+        size_t operatorLength = listOperatorLength(line, i);
+        if (operatorLength != 0)
+        {
+            lexed.arena.append(line, i, operatorLength);
+            i += operatorLength;
+        }
+        while (operatorLength == 0 && i < length && (quote != 0 || (!isBlank(line[i]) && !(stripComments && startsComment(line, i)) && listOperatorLength(line, i) == 0)))
+        {
+            char c = line[i++];
+            if (quote == '\'')
+            {
+                if (c == '\'')
+                    quote = 0;
+                else
+                    lexed.arena.push_back(c);
+            }
+            else if (c == '\\')
+            {
+                if (i == length)
+                    throw error(RETURNCODE::BAD_SYNTAX);
+                //inside double quotes, a backslash before anything else is just a backslash
+                if (quote == '"' && line[i] != '"' && line[i] != '\\' && line[i] != '$')
+                    lexed.arena.push_back(c);
+                lexed.arena.push_back(line[i++]);
+                quoted = true;
+            }
+            else if (quote == '"')
+            {
+                if (c == '"')
+                    quote = 0;
+                else
+                    lexed.arena.push_back(c);
+            }
+            else if (c == '\'' || c == '"')
+            {
+                quote = c;
+                quoted = true;
+            }
+            else
+                lexed.arena.push_back(c);
+        }
+        if (quote != 0)
             throw error(RETURNCODE::BAD_SYNTAX);
         
-        stat(tokenList[2].c_str(), &fileStruct);
-        condCode = tokenList[1];
-        format = 3;
-    }
-    
-    if (condCode == "checke")
-    {
-        if (! S_ISREG(fileStruct.st_mode))
-            format *= -1;
+        lexed.text.append(line, wordStart, i - wordStart);
+        lexed.tokens.push_back(std::string_view(lexed.arena.data() + start, lexed.arena.size() - start));
+        lexed.quoted.push_back(quoted);
     }
-    else if (condCode == "checkd")
+    return;
+}
+
+//puts single quotes around a word if the lexer wouldn't read it back as the same single unquoted word
+//used when building a line out of words that have already been through the lexer, like the arguments to parallel
+std::string quoteWord(const std::string& word)
+{
+    if (!word.empty() && word.find_first_of(" \t\v\n\r\f'\"\\$;") == std::string::npos && word.find("&&") == std::string::npos && word.find("||") == std::string::npos
+        && word != "[" && word != "]" && word != "@" && word.back() != '-')
+        return word;
+    std::string quoted = "'";
+    for (int i = 0; i < word.size(); i++)
     {
-        if (! S_ISDIR(fileStruct.st_mode))
-            format *= -1;
+        //a single quote can't go inside single quotes, so close them, add an escaped quote, and open them again
+        if (word[i] == '\'')
+            quoted += "'\\''";
+        else
+            quoted += word[i];
     }
-    else if (condCode == "checkr")
+    return quoted + "'";
+}
+
+//appends a 32 bit value to a snapshot being built
+void appendUint32(std::string& buffer, uint32_t value)
+{
+    buffer.append((const char*) &value, sizeof(value));
+}
+
+//reads one string of a compiled script file, written as its length, a space and then its bytes
+//the length is checked against what is left of the file before anything is allocated, so a damaged file just fails to load
+//returns false if the length is missing or runs past the end of the file
+bool readCachedString(std::istream& file, std::streamoff fileSize, std::string& text)
+{
+    size_t length;
+    file >> length;
+    file.get(); //the space between the length and the string
+    if (!file || length > (size_t) (fileSize - file.tellg()))
+        return false;
+    text.resize(length);
+    file.read(&text[0], length);
+    return (bool) file;
+}
+
+//prints the message for an error, used by main for errors that end a line and by runCommandList for internal commands that fail
+//returns false for an error code it doesn't know
+bool printError(RETURNCODE code)
+{
+    switch (code)
     {
-        if ((S_IRUSR & fileStruct.st_mode) != S_IRUSR)
-            format *= -1;
+        case RETURNCODE::TOO_FEW_ARGS:
+            std::cout << "Too few arguments\n";
+            break;
+            
+        case RETURNCODE::TOO_MANY_ARGS:
+            std::cout << "Too many arguments\n";
+            break;
+            
+        case RETURNCODE::INVALID_ARG:
+            std::cout << "Invalid argument\n";
+            break;
+            
+        case RETURNCODE::NO_HISTORY:
+            std::cout << "Requested line of history does not exist\n";
+            break;
+            
+        case RETURNCODE::NO_ALIAS:
+            std::cout << "Alias not found\n";
+            break;
+            
+        case RETURNCODE::NO_OVERRIDE:
+            std::cout << "Cannot override default commands\n";
+            break;
+            
+        case RETURNCODE::RECURSIVE_ALIAS:
+            std::cout << "Alias is recursive; unable to resolve\n";
+            break;
+            
+        case RETURNCODE::FILE_ERROR:
+            std::cout << "Unable to open file\n";
+            break;
+            
+        case RETURNCODE::NO_DELETE:
+            std::cout << "rm command disabled for safety\n";
+            break;
+            
+        case RETURNCODE::BAD_FORMAT:
+            std::cout << "Alias file is in incorrect format\n";
+            break;
+            
+        case RETURNCODE::COMMAND_DNE:
+            std::cout << "Command does not exist\n";
+            break;
+            
+        case RETURNCODE::NO_JOB:
+            std::cout << "No job exists with that ID\n";
+            break;
+            
+        case RETURNCODE::BAD_SYNTAX:
+            std::cout << "Invalid syntax\n";
+            break;
+            
+        case RETURNCODE::PROCESS_ERROR:
+            perror("Error in child process");
+            break;
+            
+        case RETURNCODE::CMD_NOT_FOUND:
+            std::cout << "Linux command not found\n";
+            break;
+            
+        case RETURNCODE::RECURSIVE_SCRIPT:
+            std::cout << "Recursion in script.  Exiting script mode\n";
+            break;
+            
+        case RETURNCODE::RECURSIVE_REDIRECTION:
+            std::cout << "Cannot read and write to the same file\n";
+            break;
+            
+        default:
+            return false;
     }
-    else if (condCode == "checkw")
+    return true;
+}
+
+//the errors that mean something went wrong with the shell itself rather than with a command, which still end the whole line (and a batch run)
+bool isFatalError(RETURNCODE code)
+{
+    return code == RETURNCODE::PROCESS_ERROR || code == RETURNCODE::RECURSIVE_SCRIPT;
+}
+
+//pidfd_open and pidfd_send_signal need linux 5.3 and 5.1
+//without them a process has no pidfd, and the waits only have the SIGCHLD self-pipe to go on
+int openPidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+int sendPidfdSignal(int pidfd, int sig)
+{
+#ifdef SYS_pidfd_send_signal
+    return (int) syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+//writes all of data to fd, carrying on after short writes
+//returns false if a write fails
+bool writeAll(int fd, const char* data, size_t length)
+{
+    while (length > 0)
     {
-        if ((S_IWUSR & fileStruct.st_mode) != S_IWUSR)
-            format *= -1;
+        ssize_t written = write(fd, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= written;
     }
-    else if (condCode == "checkx")
+    return true;
+}
+
+//appends the backslash escape starting at text[i] to out, and returns the index of its last character
+//handles \\ \a \b \e \f \n \r \t \v, \xHH and octal \nnn, which for echo -e and printf %b (zeroOctal) can also be written \0nnn
+//\c means stop printing altogether, which is passed back through stop
+//anything else is left as it is, backslash included
+size_t appendEscape(const std::string& text, size_t i, std::string& out, bool zeroOctal, bool& stop)
+{
+    if (i + 1 == text.size())
     {
-        if ((S_IXUSR & fileStruct.st_mode) != S_IXUSR)
-            format *= -1;
+        out += '\\';
+        return i;
     }
-    else
+    char c = text[++i];
+    switch (c)
     {
-        throw error(RETURNCODE::INVALID_ARG);
+        case '\\': out += '\\'; break;
+        case 'a': out += '\a'; break;
+        case 'b': out += '\b'; break;
+        case 'e': out += '\033'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'v': out += '\v'; break;
+        case 'c': stop = true; break;
+        case 'x':
+        {
+            int value = 0, digits = 0;
+            while (digits < 2 && i + 1 < text.size() && isxdigit((unsigned char) text[i + 1]))
+            {
+                char digit = text[++i];
+                value = value * 16 + (isdigit((unsigned char) digit) ? digit - '0' : tolower(digit) - 'a' + 10);
+                digits++;
+            }
+            if (digits == 0)
+                out += "\\x";
+            else
+                out += (char) value;
+            break;
+        }
+        default:
+            if (c >= '0' && c <= '7')
+            {
+                //for echo -e and %b the 0 in \0nnn doesn't count as one of the three digits
+                bool leadingZero = zeroOctal && c == '0';
+                int value = leadingZero ? 0 : c - '0';
+                int digits = leadingZero ? 0 : 1;
+                while (digits < 3 && i + 1 < text.size() && text[i + 1] >= '0' && text[i + 1] <= '7')
+                {
+                    value = value * 8 + (text[++i] - '0');
+                    digits++;
+                }
+                out += (char) value;
+            }
+            else
+            {
+                out += '\\';
+                out += c;
+            }
     }
-    
-    return format;
+    return i;
 }
 
-//MAIN PROGRAM FUNCTIONS
-
-//outputs toyshell[1]> (or whatever the values are at the time)
-void Shell::printCommandLine()
+//STREAM BUFFER FUNCTIONS
+fdStreamBuffer::fdStreamBuffer(int f): fd(f)
 {
-    std::cout << shellName << "[" << commandCount << "]" << shellDelimiter;
-    return;
+    setp(buffer, buffer + STAGE_BUFFER_SIZE);
 }
 
-//removes leading whitespace from command line
-//doesn't remove trailing, because that gets ignored anyway when reading into the deque
-//NO LONGER USED, as gcc < 4.9 doesn't know how to handle regex
-//i've left it in for now so I can refer back to it later
-void Shell::parseCommandLineWhitespace()
+fdStreamBuffer::~fdStreamBuffer()
 {
-        currentLine = std::regex_replace(currentLine, std::regex("^\\s* | \\s*$"), std::string(""));
+    sync();
 }
 
-//if there is a currently executing script (scriptStack not empty), uses the top of the queue as the current line
-//otherwise gets whatever is on the current command line - can be blank
-//return value is false if the line was blank or if there was some error reading the line, true otherwise
-bool Shell::readCommandLine()
+//the buffer is full, so it is written out to make room for c
+int fdStreamBuffer::overflow(int c)
 {
-    std::cin.clear();
-    
-    //if a script is executing, the next command will be in [0][0]
-    //then we pop this element
-    //if the queue at [0] is now empty, we pop it as well
-    if (scriptStack.size() != 0)
+    if (sync() == -1)
+        return traits_type::eof();
+    if (c != traits_type::eof())
     {
-        NOHISTORYFLAG = true;
-        currentLine = scriptStack[0][0];
-        std::cout << currentLine << std::endl;  //printing out the command that is going to be executed
-        
-        scriptStack[0].pop_front();  //remove the command from the queue
+        *pptr() = (char) c;
+        pbump(1);
     }
-    else
-        getline(std::cin, currentLine);
-    
-    //this erases any comments from the string
-    //note that if $ is the first non-space character that occurs, the whole string gets erased
-    //and the line is treated as though return was hit on a blank line
-    size_t comment = currentLine.find_first_of("$");
-    if (comment != std::string::npos)
-        currentLine.erase(comment);
-    
-    //check to make sure line isn't just blank spaces
-    //cut out everything up to the first non blank character
-    //if the line contains no non-blanks, it erases the whole line
-    size_t blanks = currentLine.find_first_not_of(" \t\v");
-    currentLine.erase(0, blanks);
-    //then erases trailing blanks
-    blanks = currentLine.find_last_not_of(" \t\v");
-    if (blanks != std::string::npos)
-        currentLine.erase(blanks+1);
-    
-    if (currentLine[0] == '!')
-        replaceWithHistory();
-    //note that the replaceWithHistory command runs immediately - anything beginning with a ! is assumed to be this command and the appropriate history is inserted before continuing
-    
-    return std::cin.good() && currentLine != "";
+    return traits_type::not_eof(c);
 }
 
-//splits the given string into words and adds them to the given array
-//this code is called both by parseCommandLine which splits the command into the tokenList
-//as well as replaceWithHistory, which writes into a temp array
-void Shell::tokenizeString(std::string str, std::deque<std::string>* tokenArray)
+//writes out whatever is in the buffer, and empties it even if the write fails, so a closed pipe doesn't fill it for good
+int fdStreamBuffer::sync()
 {
-    std::istringstream tokenizer(str);
-    tokenizer.clear();  //clears end of file flag, otherwise can't switch to read mode
-    std::string temp;
-    while (tokenizer >> temp)
-    {
-        tokenArray->push_back(temp);
-    }
-    return;
+    bool written = writeAll(fd, pbase(), pptr() - pbase());
+    setp(buffer, buffer + STAGE_BUFFER_SIZE);
+    return written ? 0 : -1;
 }
 
-//checks for input and output file redirection, as well as piping between commands
-void Shell::parseRedirection()
+//appends value to out, formatted by spec (a single printf conversion)
+template <typename T>
+void appendFormatted(std::string& out, const std::string& spec, T value)
 {
-    std::deque<std::string> tempArray; //used to delete elements from the tokenList, since erase() invalidates pointers
-    tempArray.push_back(tokenList[0]);
-    
-    childSubCommands.clear();
-    std::deque<std::string> tempCmd;
-    tempCmd.push_back(tokenList[0]);
-    std::string inputFileName = "";
-    
-    int file;
-    bool flag = false; //used to determine if we need to recopy from the tempArray
+    int length = snprintf(NULL, 0, spec.c_str(), value);
+    if (length <= 0)
+        return;
+    size_t start = out.size();
+    out.resize(start + length + 1);
+    snprintf(&out[start], length + 1, spec.c_str(), value);
+    out.resize(start + length);
+}
+
+//reads a whole word as a number for test and printf, false if it isn't one
+bool parseInteger(const std::string& word, long long& value, int base)
+{
+    char* end;
+    errno = 0;
+    value = strtoll(word.c_str(), &end, base);
+    return !word.empty() && *end == '\0' && errno == 0;
+}
+
+//the expression parser of the test utility, one function per level: -o, then -a, then !, then a single test
+//pos is the next word of args to read, and valid is cleared on a syntax error
+bool testOr(const std::vector<std::string>& args, size_t& pos, bool& valid);
+
+bool testPrimary(const std::vector<std::string>& args, size_t& pos, bool& valid)
+{
+    if (pos >= args.size())
+    {
+        valid = false;
+        return false;
+    }
+    const std::string& word = args[pos];
     
-    //since the first token can't be either [ or ], I start at index 1 to avoid potentially empty commands once the file names are removed
-    //if the first token is a [ or ], it will give an error when trying to run the command anyway
-    for (int i = 1; i < tokenList.size(); i++)
+    //a binary operator is looked for first, so that eg "test -n = -n" compares two strings, like other shells
+    if (pos + 2 < args.size())
     {
-        if (tokenList[i] == "[" || tokenList[i] == "]" || tokenList[i] == "@")
+        const std::string& op = args[pos + 1];
+        const std::string& right = args[pos + 2];
+        bool binary = true, result = false;
+        long long left, rightValue;
+        struct stat leftStat, rightStat;
+        if (op == "=" || op == "==")
+            result = (word == right);
+        else if (op == "!=")
+            result = (word != right);
+        else if (op == "<")
+            result = (word < right);
+        else if (op == ">")
+            result = (word > right);
+        else if (op == "-eq" || op == "-ne" || op == "-lt" || op == "-le" || op == "-gt" || op == "-ge")
         {
-            if (tokenList[i] == "[")
-            {
-                //next index must exist
-                if (tokenList.size() < (i + 2))
-                    throw error(RETURNCODE::TOO_FEW_ARGS);
-                   
-                //open next token for reading and duplicate it into stdin
-                inputFileName = tokenList[i+1];
-                file = open(inputFileName.c_str(), O_RDONLY);
-                if (file == -1)
-                    throw error(RETURNCODE::FILE_ERROR);
-                dup2(file, STDIN_FILENO);
-                close(file);
-                i++; //we already handled the next token - the file name
-            }
-            else if (tokenList[i] == "]")
+            if (!parseInteger(word, left, 10) || !parseInteger(right, rightValue, 10))
             {
-                if (tokenList.size() < (i + 2))
-                    throw error(RETURNCODE::TOO_FEW_ARGS);
-                   
-                //open next token for writing and duplicate it into stdout
-                if (tokenList[i+1] == inputFileName)
-                    throw error(RETURNCODE::RECURSIVE_REDIRECTION);
-                file = open(tokenList[i+1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-                if (file == -1)
-                    throw error(RETURNCODE::FILE_ERROR);
-                dup2(file, STDOUT_FILENO);
-                close(file);
-                i++;
+                std::cerr << "test: integer expression expected\n";
+                valid = false;
+                return false;
             }
+            result = (op == "-eq") ? left == rightValue : (op == "-ne") ? left != rightValue : (op == "-lt") ? left < rightValue
+                : (op == "-le") ? left <= rightValue : (op == "-gt") ? left > rightValue : left >= rightValue;
+        }
+        else if (op == "-nt" || op == "-ot" || op == "-ef")
+        {
+            bool leftExists = stat(word.c_str(), &leftStat) == 0;
+            bool rightExists = stat(right.c_str(), &rightStat) == 0;
+            if (op == "-ef")
+                result = leftExists && rightExists && leftStat.st_dev == rightStat.st_dev && leftStat.st_ino == rightStat.st_ino;
             else
             {
-                childSubCommands.push_back(tempCmd);
-                tempCmd.clear();
+                //a file that doesn't exist is older than one that does
+                bool newer = leftExists && (!rightExists || leftStat.st_mtim.tv_sec > rightStat.st_mtim.tv_sec
+                    || (leftStat.st_mtim.tv_sec == rightStat.st_mtim.tv_sec && leftStat.st_mtim.tv_nsec > rightStat.st_mtim.tv_nsec));
+                bool older = rightExists && (!leftExists || rightStat.st_mtim.tv_sec > leftStat.st_mtim.tv_sec
+                    || (rightStat.st_mtim.tv_sec == leftStat.st_mtim.tv_sec && rightStat.st_mtim.tv_nsec > leftStat.st_mtim.tv_nsec));
+                result = (op == "-nt") ? newer : older;
             }
-            flag = true; //we now need to remove at least one token from the list
         }
         else
+            binary = false;
+        if (binary)
         {
-            //if a file redirection token was not encountered, we copy the current element to the temp array
-            tempArray.push_back(tokenList[i]);
-            tempCmd.push_back(tokenList[i]);
+            pos += 3;
+            return result;
         }
     }
-    childSubCommands.push_back(tempCmd); //push back the last command, it will have been missed in the loop
     
-    //after iterating through the original list, we might need to recopy from the temp array in order to delete the [ ] tokens as well as the file names
-    if (flag)
+    if (word == "(" && pos + 1 < args.size())
     {
-        tokenList.clear();
-        tokenList.resize(tempArray.size());
-        std::copy(tempArray.begin(), tempArray.end(), tokenList.begin());
+        pos++;
+        bool result = testOr(args, pos, valid);
+        if (pos >= args.size() || args[pos] != ")")
+            valid = false;
+        pos++;
+        return result;
+    }
+    
+    if (word.size() == 2 && word[0] == '-' && pos + 1 < args.size() && std::string("efdrwxszLhbcpSn").find(word[1]) != std::string::npos)
+    {
+        const std::string& operand = args[pos + 1];
+        pos += 2;
+        struct stat fileStat;
+        switch (word[1])
+        {
+            case 'z': return operand.empty();
+            case 'n': return !operand.empty();
+            case 'r': return access(operand.c_str(), R_OK) == 0;
+            case 'w': return access(operand.c_str(), W_OK) == 0;
+            case 'x': return access(operand.c_str(), X_OK) == 0;
+            case 'L':
+            case 'h': return lstat(operand.c_str(), &fileStat) == 0 && S_ISLNK(fileStat.st_mode);
+        }
+        if (stat(operand.c_str(), &fileStat) != 0)
+            return false;
+        switch (word[1])
+        {
+            case 'f': return S_ISREG(fileStat.st_mode);
+            case 'd': return S_ISDIR(fileStat.st_mode);
+            case 's': return fileStat.st_size > 0;
+            case 'b': return S_ISBLK(fileStat.st_mode);
+            case 'c': return S_ISCHR(fileStat.st_mode);
+            case 'p': return S_ISFIFO(fileStat.st_mode);
+            case 'S': return S_ISSOCK(fileStat.st_mode);
+        }
+        return true; //-e
     }
+    
+    //anything else is a string, true if it isn't empty
+    pos++;
+    return !word.empty();
 }
 
-void Shell::parseCommandLine()
+bool testNot(const std::vector<std::string>& args, size_t& pos, bool& valid)
 {
-    //first tokenize the string into token list, which by the nature of my implementation automatically gets rid of leading, trailing, and extra spaces
-    tokenizeString(currentLine, &tokenList);
+    if (pos + 1 < args.size() && args[pos] == "!")
+    {
+        pos++;
+        return !testNot(args, pos, valid);
+    }
+    return testPrimary(args, pos, valid);
+}
 
-    //leading and trailing spaces are removed from the string version of the command in readCommandLine(), but not extra spaces between words
-    //so I recreate the string from the tokens, which allows me to use it later in a few places
-    currentLine = tokenList[0];
-    for (int i = 1; i < tokenList.size(); i++)
-        currentLine = currentLine + " " + tokenList[i];
-    
-    return;
+bool testAnd(const std::vector<std::string>& args, size_t& pos, bool& valid)
+{
+    bool result = testNot(args, pos, valid);
+    while (pos < args.size() && args[pos] == "-a")
+    {
+        pos++;
+        result = testNot(args, pos, valid) && result;
+    }
+    return result;
 }
 
-//loops through the input string, assumed to be in tokenList, replaces all aliases, checks for recursive aliasing
-//throws RECURSIVE_ALIAS
-void Shell::parseAliases()
+bool testOr(const std::vector<std::string>& args, size_t& pos, bool& valid)
 {
-        bool replacementFlag;
-        int tokenIndex, aliasIndex;
-        
-        std::forward_list<std::string> tempArray;  //using a forward list rather than a regular list so I can use insert_after
-        std::forward_list<std::string>::iterator tempIndex;
-        std::deque<std::string> recursiveAliasCheck;  //alias is recursive if the same alias comes up again in the same location
-        //or a location created by the first alias
-        
-        //we first copy everything from the real token array to a temporary one
-        //this allows us to insert multi word aliases into the original location
-        //we do the alias checks on this temp array
-        //and then copy everything back
-        //I'm sure there's a better way to do this but,
+    bool result = testAnd(args, pos, valid);
+    while (pos < args.size() && args[pos] == "-o")
+    {
+        pos++;
+        result = testAnd(args, pos, valid) || result;
+    }
+    return result;
+}
 
-        //iterating in reverse order because forward_list only has a push front method, not push back
-        for (tokenIndex = (int) tokenList.size() - 1; tokenIndex >= 0; tokenIndex--)
-        {
-            tempArray.push_front(tokenList[tokenIndex]);
-        }
-        
-        tokenList.clear();
-            
-        for (tempIndex = tempArray.begin(); tempIndex != tempArray.end(); tempIndex++)
+//finds a basis for fnv1aChecksum that puts every name in the builtin table in a slot of its own
+//returns 0 if none of the first 100000 work (the static_assert in findBuiltin catches that)
+constexpr uint32_t findBuiltinSeed(const builtinCommand* table)
+{
+    for (uint32_t seed = 1; seed < 100000; seed++)
+    {
+        std::array<bool, BUILTIN_SLOTS> used = {};
+        bool clash = false;
+        for (int i = 0; i < BUILTIN_COUNT && !clash; i++)
         {
-            do
-            {
-                replacementFlag = false;
-                
-                for (aliasIndex = 0; aliasIndex < aliasList.size(); aliasIndex++)
-                {
-                    //if the token currently pointed at matches one of the alias keys, we replace it
-                    if (*tempIndex == aliasList[aliasIndex][0])
-                    {
-                        for (int i = 0; i < recursiveAliasCheck.size(); i++)
-                        {
-                            //check to make sure that the new value hasn't already come up on this cycle, indicating a circular alias
-                            if (aliasList[aliasIndex][1] == recursiveAliasCheck[i])
-                                throw error(RETURNCODE::RECURSIVE_ALIAS);
-                        }
-                        recursiveAliasCheck.push_back(*tempIndex);  //add the alias to the checking queue
-                        
-                        replacementFlag = true;
-                        *tempIndex = aliasList[aliasIndex][1];  //there is guaranteed to be one value, so copy it first
-                        //then insert any additional tokens, increasing the size of the list
-                        //this is being done in reverse order just like the push_front above, because otherwise I would need to maintain a seperate iterator for the insert location
-                        for (int valueIndex = (int) aliasList[aliasIndex].size() - 1; valueIndex >= 2; valueIndex--)
-                        {
-                            for (int i = 0; i < recursiveAliasCheck.size() - 1; i++)
-                            {
-                                if (aliasList[aliasIndex][valueIndex] == recursiveAliasCheck[i])
-                                    throw error(RETURNCODE::RECURSIVE_ALIAS);
-                            }
-                            tempArray.insert_after(tempIndex, aliasList[aliasIndex][valueIndex]);
-                        }
-                    }
-                    if (replacementFlag)
-                        break; //if we replaced the token on this pass, the while loop is going to cause a restart of the for loop anyway, may as well just break out now and save a couple cycles
-                }
-            } while (replacementFlag);
-            //if a match was found, we need to repeat on the same index, which now contains the first value from the alias list
-            //if we did not replace on this pass, we can push the value, whether original token or alias, back to the original array
-            tokenList.push_back(*tempIndex);
+            uint32_t slot = fnv1aChecksum(table[i].name.data(), table[i].name.size(), seed) % BUILTIN_SLOTS;
+            clash = used[slot];
+            used[slot] = true;
         }
-    return;
+        if (!clash)
+            return seed;
+    }
+    return 0;
 }
 
-//adds whatever was on the input line, minus leading and trailing spaces, to the history queue
-void Shell::addCommandToHistory()
+constexpr std::array<signed char, BUILTIN_SLOTS> buildBuiltinSlots(const builtinCommand* table, uint32_t seed)
 {
-    //delete the first (oldest) element if the queue is full
-    if (historyList.size() == maxHistorySize)
-        historyList.pop_front();
-    historyList.push_back(currentLine);
-    return;
+    std::array<signed char, BUILTIN_SLOTS> slots = {};
+    for (int i = 0; i < BUILTIN_SLOTS; i++)
+        slots[i] = -1;
+    for (int i = 0; i < BUILTIN_COUNT; i++)
+        slots[fnv1aChecksum(table[i].name.data(), table[i].name.size(), seed) % BUILTIN_SLOTS] = (signed char) i;
+    return slots;
 }
 
-//selects the right command to run
-//assumes the command is already in tokenList
-void Shell::execCommand()
+//the builtin table, in alphabetical order
+//the argument limits here are the only check most commands need, the ones whose arguments depend on an option still check the rest themselves
+//the last column is whether the command can be part of an @ chain, which is only worth it for the ones that print something
+constexpr builtinCommand Shell::builtinTable[BUILTIN_COUNT] =
 {
-    commandCount++;
-    
-    //find the value in the command map
-    std::map<std::string, void(*)(Shell*)>::iterator it = commandMap.find(tokenList[0]);
-    
-    //if the command does not resolve to one of the internal functions, assume it's Linux and let the OS handle it
-    if (it == commandMap.end())
-        functionPointer = &staticRunLinuxCommand;
-    else
-        functionPointer = it->second;
-    
-    
-    //calling the static function chosen with the current object, so they can call this->realFunction()
-    functionPointer(this);
-    
-    return;
+    {"!", NULL, &REPLACEHISTINFO, 0, -1, false},
+    {"backjobs", &staticPrintBGJobs, &BACKJOBINFO, 0, 0, true},
+    {"bg", &staticContinueJob, &BGINFO, 1, 1, false},
+    {"cond", NULL, &CONDINFO, 0, -1, false},
+    {"cull", &staticCull, NULL, 1, 1, false},
+    {"frontjob", &staticBringJobToFG, &FRONTJOBINFO, 1, 1, false},
+    {"hash", &staticHashCommand, &HASHINFO, 0, -1, true},
+    {"history", &staticPrintHistory, &HISTORYINFO, 0, -1, true},
+    {"jobstats", &staticPrintJobStats, &JOBSTATSINFO, 0, 0, true},
+    {"man", &staticInfoCommand, NULL, 1, -1, false},
+    {"newname", &staticNewnameCommand, &NEWNAMEINFO, 1, -1, false},
+    {"newnames", &staticPrintAliases, &PRINTALIASINFO, 0, -1, true},
+    {"notcond", NULL, &CONDINFO, 0, -1, false},
+    {"output", &staticOutput, NULL, 0, -1, false},
+    {"parallel", &staticParallel, &PARALLELINFO, 2, -1, false},
+    {"readnewnames", &staticReadAliasFile, &READALIASINFO, 1, 1, false},
+    {"savenewnames", &staticSaveNewAliasFile, &SAVEALIASINFO, 1, 2, false},
+    {"scriptcache", &staticScriptCacheCommand, &SCRIPTCACHEINFO, 0, 2, true},
+    {"setaliassize", &staticSetAliasSize, &SETALIASSIZEINFO, 0, 1, true},
+    {"sethistorysize", &staticSetHistorySize, &SETHISTORYSIZEINFO, 0, 1, true},
+    {"setlauncher", &staticSetLauncher, &SETLAUNCHERINFO, 1, 1, false},
+    {"setshellname", &staticSetShellName, &SETSHELLINFO, 1, -1, false},
+    {"setterminator", &staticSetShellDelimiter, &SETDELIMINFO, 1, 1, false},
+    {"setutilities", &staticSetUtilities, &SETUTILITIESINFO, 1, 1, false},
+    {"stop", &staticExit, NULL, 0, -1, false},
+    {"transfer", &staticTransfer, &TRANSFERINFO, 0, -1, false},
+    {"usescript", &staticUsescript, &USESCRIPTINFO, 1, -1, false}
+};
+constexpr uint32_t Shell::builtinSeed = findBuiltinSeed(Shell::builtinTable);
+constexpr std::array<signed char, BUILTIN_SLOTS> Shell::builtinSlots = buildBuiltinSlots(Shell::builtinTable, Shell::builtinSeed);
+
+//there is at most one name per slot, so a name is either that one or not a builtin at all
+const builtinCommand* Shell::findBuiltin(std::string_view name)
+{
+    static_assert(builtinSeed != 0, "no seed gives every builtin its own slot, increase BUILTIN_SLOTS");
+    int slot = builtinSlots[fnv1aChecksum(name.data(), name.size(), builtinSeed) % BUILTIN_SLOTS];
+    if (slot == -1 || builtinTable[slot].name != name)
+        return NULL;
+    return &builtinTable[slot];
 }
 
-//COMMAND FUNCTIONS
+//the linux utilities the shell can run itself, see runUtility
+constexpr utilityCommand Shell::utilityTable[UTILITY_COUNT] = {
+    {"cat", &catUtility},
+    {"echo", &echoUtility},
+    {"false", &falseUtility},
+    {"printf", &printfUtility},
+    {"test", &testUtility},
+    {"true", &trueUtility}
+};
 
-void Shell::staticPrintHistory(Shell* s)
+//there are only a handful of them, so a linear search is plenty
+int Shell::findUtility(std::string_view name)
 {
-    s->printHistory();
+    for (int i = 0; i < UTILITY_COUNT; i++)
+        if (utilityTable[i].name == name)
+            return i;
+    return -1;
 }
 
-//prints history queue
-//does not throw, since no history isn't an error
-void Shell::printHistory()
+//readies the shell for the next line of input
+//called after all commands, whether successful or not
+//resets the tokenList and closes any redirection files an error might have left open, since currentLine gets overwritten every time
+void Shell::reset()
 {
-    if (historyList.size() == 0)
-        std::cout << "No history to display\n";
-    
-    for (int i = 0; i < historyList.size(); i++)
-    {
-        std::cout << i + 1 << ": " << historyList[i] << std::endl;
-    }
+    tokenList.clear();
+    tokenQuoted.clear();
+    backgroundMode = false;
+    currentTree = NULL;
+    closeRedirectionFiles();
     return;
 }
 
-void Shell::staticPrintAliases(Shell* s)
+//closes every file openRedirectionFiles opened, once the children have their own copies (or an error means they never will)
+void Shell::closeRedirectionFiles()
 {
-    s->printAliases();
+    for (int i = 0; i < stageInputFDs.size(); i++)
+        if (stageInputFDs[i] != -1)
+            close(stageInputFDs[i]);
+    for (int i = 0; i < stageOutputFDs.size(); i++)
+        if (stageOutputFDs[i] != -1)
+            close(stageOutputFDs[i]);
+    stageInputFDs.clear();
+    stageOutputFDs.clear();
+    return;
 }
 
-//prints aliases
-//does not throw, since no aliases isn't an error
-void Shell::printAliases()
+void Shell::staticSetShellName(Shell* s)
 {
-    if (aliasList.size() == 0)
-        std::cout << "No aliases.  Use the newname command to enter a new alias\n";
-    else
-    {
-        for (int i = 0; i < aliasList.size(); i++)
-        {
-            std::cout << i << ": ";
-            //because alias list is a queue of queues, we need a double for loop to print
-            for (int j = 0; j < aliasList[i].size(); j++)
-                std::cout << aliasList[i][j] << " ";
-            std::cout << std::endl;
-        }
-    }
+    s->setShellName();
+}
+
+//sets the shell name to the everything after the first token
+//note that shell name is allowed to be multiple words, with spaces
+void Shell::setShellName()
+{
+    std::string newName = tokenList[1];
+    for (int i = 2; i < tokenList.size(); i++)
+        newName = newName + " " + tokenList[i];
+    shellName = newName;
+    saveConfig();
     return;
 }
 
-void Shell::staticNewnameCommand(Shell* s)
+void Shell::staticSetShellDelimiter(Shell* s)
 {
-    s->newnameCommand();
+    s->setShellDelimiter();
 }
 
-//if there are two commands, calls deleteAlias
-//if there are more than two, calls addNewAlias
-//throw TOO_FEW_ARGS otherwise
-void Shell::newnameCommand()
+//sets delim to the second token
+//unlike shell name, I decided the delimiter should only be one "word"
+void Shell::setShellDelimiter()
 {
-    if (tokenList.size() == 2)
-        deleteAlias();
-    else if (tokenList.size() > 2)
-        addNewAlias();
-    else
-        throw error(RETURNCODE::TOO_FEW_ARGS);
+    std::string newDelim = tokenList[1];
+    shellDelimiter = newDelim;
+    saveConfig();
+    return;
 }
 
-void Shell::staticDeleteAlias(Shell* s)
+void Shell::saveConfig()
 {
-    s->deleteAlias();
+    if (batchMode)
+        return;
+    std::ofstream configFile("config.ini", std::ios::trunc);
+    configFile << shellName << " " << shellDelimiter;
+    configFile.close();
+    return;
 }
 
-//searches the alias list for the key, assumed to be the second token, and removes the alias if found
-//throws NO_ALIAS if not found, including if the alias list is empty
-void Shell::deleteAlias()
+//replaces "! #" commands with the specified line of history
+//"! N" is the command numbered N in the prompt, found in the history ring, and "! #N" is entry N of the history file
+//the number is read straight out of currentLine, rather than tokenizing the whole line
+//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there are not exactly two arguments
+//throws INVALID_ARG if the argument isn't a number
+//throws NO_HISTORY if that line of history doesn't exist
+void Shell::replaceWithHistory()
 {
-    //no need to check that index 1 exists, that happens in Shell::newnameCommand()
-    std::string key = tokenList[1];
-    bool deletionFlag = false;
+    size_t start = currentLine.find_first_not_of(" \t\v", 1);
+    if (start == std::string::npos)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
     
-    //iterate through each element in aliasList
-    //since aliasList is a 2D queue, the key is position [i][0] and the value is position [i][1]
-
-    if (aliasList.size() == 0)
-        throw error(RETURNCODE::NO_ALIAS);
+    bool fromFile = (currentLine[start] == '#');
+    if (fromFile)
+        start++;
+    
+    //strtol skips leading blanks and signs, so make sure the argument really starts with a digit
+    const char* number = currentLine.c_str() + start;
+    char* end;
+    errno = 0;
+    long index = strtol(number, &end, 10);
+    if (!isdigit((unsigned char) *number) || errno == ERANGE || (*end != '\0' && !isspace((unsigned char) *end)))
+        throw error(RETURNCODE::INVALID_ARG);
+    if (currentLine.find_first_not_of(" \t\v", end - currentLine.c_str()) != std::string::npos)
+        throw error(RETURNCODE::TOO_MANY_ARGS);
     
-    //deque::erase() requires an iterator, which is why I use that rather than int i = 0
-    //this then requires the use of pointer references for i->at and i->clear
-    for (std::deque<std::deque<std::string>>::iterator current = aliasList.begin(); current < aliasList.end(); current++)
+    if (fromFile)
     {
-        if (current->at(0) == key)
-        {
-            //because it's a 2D queue, I first call clear on the lower dimension to delete the two strings
-            //then erase on the upper dimension to delete the lower level queue
-            current->clear();
-            aliasList.erase(current);
-            //can't be in there more than once, so just break out of the loop and exit
-            deletionFlag = true;
-            break;
-        }
+        //check to see if that line of history exists, anywhere in the history file
+        indexHistory();
+        if (historyOffsets.size() < index || index <= 0)
+            throw error(RETURNCODE::NO_HISTORY);
+        //note index - 1, to compensate between standard counting starting at 1, and the historyOffsets indexing which of course begins at 0
+        size_t length;
+        const char* command = historyCommand(index - 1, length);
+        currentLine.assign(command, length);
+        return;
     }
     
-    if (!deletionFlag)
-        throw error(RETURNCODE::NO_ALIAS);
-    
+    const historySlot* slot = findHistorySlot(index);
+    if (slot == NULL)
+        throw error(RETURNCODE::NO_HISTORY);
+    currentLine = *slot->command;
     return;
 }
 
-void Shell::staticAddNewAlias(Shell* s)
+//creates a job for the stages of tree, which were started at launchClock in process group pgid
+//each process gets a pidfd straight away, which is safe since nothing can collect it (and free up its pid) before the shell does
+bgJob Shell::createJob(int jobID, const commandTree& tree, std::vector<pid_t> childList, struct timespec launchClock, pid_t pgid)
 {
-    s->addNewAlias();
+    bgJob job(jobID, childList, currentLine, time(NULL), launchClock, pgid);
+    for (int i = 0; i < job.processList.size(); i++)
+        if (job.processList[i].pid > 0)
+            job.processList[i].pidfd = openPidfd(job.processList[i].pid);
+    for (int i = 0; i < job.processList.size() && i < tree.stages.size(); i++)
+    {
+        const std::deque<std::string>& words = tree.stages[i].words;
+        job.processList[i].cmd = words[0];
+        for (int j = 1; j < words.size(); j++)
+            job.processList[i].cmd += " " + words[j];
+    }
+    return job;
 }
 
-//add new key value pair to the end of the queue
-//aliasList is a 2D queue - a deque where each entry is another deque of variable size depending on how long the alias is
-//this probably isn't the most efficient solution, given the requirement to delete from the beginning, add to the end, search and retrieve any mapping, as well as delete from the middle.  Deque does the first two well, Map does the last two, so this feels like a bit of an inelegant solution
-//if there wasn't a hard cap of size 10, I would probably have written my own double ended map class
-//throws NO_OVERRIDE if the user tries to use an internal function name as an alias name
-//throws RECURSIVE_ALIAS if any token in the alias value is the same as the key
-void Shell::addNewAlias()
+//increments the job count, creates the job, adds to the job map
+void Shell::addJobToBGQueue(const commandTree& tree, std::vector<pid_t> childList, struct timespec launchClock, pid_t pgid)
 {
-    //first check to make sure the new alias isn't a preexisting command
-    std::map<std::string, void(*)(Shell*)>::iterator it = commandMap.find(tokenList[1]);
-    if (it != commandMap.end())
-        throw error(RETURNCODE::NO_OVERRIDE);
-    
-    //no need to check that these values exist, that was already done in newnameCommand()
-    std::string key = tokenList[1];
-    std::string value;
-    bool duplicate = false;
-    
-    //if full, deletes the top element first
-    if (aliasList.size() == maxAliasSize)
-        aliasList.pop_front();
-    
-    //if the alias already exists, replace the old one
-    for (std::deque<std::deque<std::string>>::iterator i = aliasList.begin(); i < aliasList.end(); i++)
+    bgJobCount++;
+    bgJob job = createJob(bgJobCount, tree, childList, launchClock, pgid);
+    bgJobQueue.insert(std::pair<int, bgJob>(bgJobCount, job));
+    return;
+}
+
+//gives a foreground job that was stopped (eg by ctrl-z) a job ID and puts it in the job map, unless it came from there with frontjob
+//either way, prints a notice so the user knows which job ID to continue
+void Shell::addStoppedJob(bgJob& job)
+{
+    if (job.jobID == 0)
     {
-        //if the key already exists, check for exact duplicate - if yes then leave it, otherwise delete the old value
-        if (i->at(0) == key)
-        {
-            if (tokenList.size() - 1 == i->size())
-            {
-                duplicate = true;
-                for (int j = 0; j < i->size(); j++)
-                {
-                    if (tokenList[j + 1] != i->at(j))
-                        duplicate = false;
-                }
-            }
-            if (!duplicate)
-                aliasList.erase(i);  //this just erases the whole line, as opposed to leaving the key
-            //doing so means I can always follow the same process for adding an alias, without having to determine if it's a replacement or not
-            //it also means the "new" alias gets pushed to the end of the queue rather than maintaining it's original position
-            break;
-        }
+        bgJobCount++;
+        job.jobID = bgJobCount;
+        bgJobQueue.insert(std::pair<int, bgJob>(bgJobCount, job));
+    }
+    //the ^Z the terminal echoed is still on the line
+    std::cout << "\n[" << job.jobID << "] " << std::left << std::setw(12) << "Stopped" << std::right << job.cmd << "\n";
+    return;
+}
+
+//only async-signal-safe calls are allowed in here, so it just pokes the self-pipe
+//the pipe is non-blocking, if it is already full there is a reap pending anyway
+void Shell::sigchldHandler(int)
+{
+    int savedErrno = errno;
+    char byte = 0;
+    if (write(sigchldPipe[1], &byte, 1) == -1) {}
+    errno = savedErrno;
+}
+
+//collects every background process whose pidfd shows it has finished, and if there has been a SIGCHLD since the last call, checks them all for stops as well
+//then prints a notice for every background job that has just stopped (eg one that tried to read the terminal),
+//and a notice for, and removes, every background job whose processes have all finished
+//foreground commands are always waited for before the next prompt, so anything collected here is a background process
+void Shell::reapChildren()
+{
+    std::vector<bgJob*> jobs;
+    std::vector<bool> wasStopped;
+    for (std::map<int, bgJob>::iterator i = bgJobQueue.begin(); i != bgJobQueue.end(); i++)
+    {
+        if (i->second.runningCount == 0)
+            continue;
+        jobs.push_back(&i->second);
+        wasStopped.push_back(i->second.stopped);
     }
+    waitForProcesses(jobs, 0);
+    if (childSignalled)
+    {
+        for (int i = 0; i < jobs.size(); i++)
+            for (int j = 0; j < jobs[i]->processList.size(); j++)
+                collectProcess(*jobs[i], j);
+        childSignalled = false;
+    }
+    for (int i = 0; i < jobs.size(); i++)
+        if (jobs[i]->stopped && !wasStopped[i] && jobs[i]->runningCount > 0)
+            std::cout << "[" << jobs[i]->jobID << "] " << std::left << std::setw(12) << "Stopped" << std::right << jobs[i]->cmd << "\n";
     
-    if (!duplicate)
+    std::vector<int> markForDeletion;
+    for (std::map<int, bgJob>::iterator i = bgJobQueue.begin(); i != bgJobQueue.end(); i++)
     {
-        //the first element in the queue is the key and everything afterwards is the value
-        std::deque<std::string> newAliasPair;
-        newAliasPair.push_back(key);
-        for (int i = 2; i < tokenList.size(); i++)
-        {
-            value = tokenList[i];
-            //recursion check - if any value of the alias is also the key, it won't be able to resolve
-            if (value == key)
-                throw error(RETURNCODE::RECURSIVE_ALIAS);
-            newAliasPair.push_back(value);
-        }
-        //then push the entire queue to the full 2D alias list
-        aliasList.push_back(newAliasPair);
+        bgJob& cur = i->second;
+        if (cur.runningCount > 0)
+            continue;
+        
+        //like the foreground commands, a pipeline's result is the result of its last command
+        int lastStatus = cur.processList.back().status;
+        std::ostringstream result;
+        if (WIFEXITED(lastStatus) && WEXITSTATUS(lastStatus) == 0)
+            result << "Done";
+        else if (WIFEXITED(lastStatus))
+            result << "Exit " << WEXITSTATUS(lastStatus);
+        else if (WIFSIGNALED(lastStatus))
+            result << strsignal(WTERMSIG(lastStatus));
+        std::cout << "[" << cur.jobID << "] " << std::left << std::setw(12) << result.str() << std::right << cur.cmd << "\n";
+        addJobToStats(cur);
+        markForDeletion.push_back(i->first);
     }
+    
+    for (int i = 0; i < markForDeletion.size(); i++)
+        bgJobQueue.erase(markForDeletion[i]);
     return;
 }
 
-void Shell::staticSaveNewAliasFile(Shell* s)
+//marks command index of the job as finished and stores how it ended
+//its pidfd is closed, since the pid is free to be reused from here on
+void Shell::recordProcessEnd(bgJob& job, int index, int status, const struct rusage& usage)
 {
-    s->saveNewAliasFile();
+    bgProcess& process = job.processList[index];
+    if (process.pidfd != -1)
+        close(process.pidfd);
+    process.pidfd = -1;
+    process.finished = true;
+    process.status = status;
+    process.endTime = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &process.endClock);
+    process.usage = usage;
+    job.runningCount--;
+    return;
 }
 
-//saves the alias list to the file name specified in tokenList[1], creates it if it doesn't exist
-//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there aren't exactly two tokens
-//throws FILE_ERROR if for some reason it isn't able to open the file fro writing
-void Shell::saveNewAliasFile()
+//collects whatever has happened to command index of job without blocking: an exit is recorded, and a stop or continue changes job.stopped
+//the pid can't be reused until the shell has collected it, so waiting on that pid (rather than on any child) is safe here
+//returns false if nothing has happened to it
+bool Shell::collectProcess(bgJob& job, int index)
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    
-    //opening in trunc mode to overwrite anything there previously
-    std::ofstream aliasFile(tokenList[1], std::ios::trunc);
-    if (!aliasFile)
-        throw error(RETURNCODE::FILE_ERROR);
+    bgProcess& process = job.processList[index];
+    if (process.finished)
+        return false;
     
-    for (int i = 0; i < aliasList.size(); i++)
+    int status;
+    struct rusage usage;
+    pid_t pid = wait4(process.pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+    if (pid == 0 || (pid == -1 && errno == EINTR))
+        return false;
+    if (pid == -1)
+    {
+        //it isn't the shell's child any more, so there's nothing left to wait for
+        memset(&usage, 0, sizeof(usage));
+        recordProcessEnd(job, index, 0, usage);
+    }
+    else if (WIFSTOPPED(status))
+        job.stopped = true;
+    else if (WIFCONTINUED(status))
+        job.stopped = false;
+    else
+        recordProcessEnd(job, index, status, usage);
+    return true;
+}
+
+//records the exits of background processes as soon as the self-pipe shows a SIGCHLD, so a process's end time is when it finished and not when the shell next looked
+//only exits are collected, a stop or continue is left for reapChildren to find (childSignalled is set whenever the pipe is emptied) so it can print its notice
+//a stopped process isn't reported by a wait without WUNTRACED, so nothing is lost here
+void Shell::collectBackgroundExits()
+{
+    for (std::map<int, bgJob>::iterator it = bgJobQueue.begin(); it != bgJobQueue.end(); it++)
     {
-        for (int j = 0; j < aliasList[i].size(); j++)
+        bgJob& job = it->second;
+        for (int i = 0; i < job.processList.size(); i++)
         {
-            aliasFile << aliasList[i][j] << " ";
+            if (job.processList[i].finished)
+                continue;
+            int status;
+            struct rusage usage;
+            if (wait4(job.processList[i].pid, &status, WNOHANG, &usage) == job.processList[i].pid)
+                recordProcessEnd(job, i, status, usage);
         }
-        aliasFile << std::endl;
     }
-    
-    aliasFile.close();
     return;
 }
 
-void Shell::staticReadAliasFile(Shell* s)
+//sleeps at the prompt until there is input on stdin, collecting background exits whenever a SIGCHLD arrives in the meantime
+//the notices themselves are still printed by reapChildren before the next prompt, so they don't land in the middle of what is being typed
+void Shell::waitForInput()
 {
-    s->readAliasFile();
+    //stdin is always a terminal here (anything else is batch mode), and a terminal hands over at most one line per read,
+    //so the last getline can't have left a whole line sitting in a buffer where poll wouldn't see it
+    while (true)
+    {
+        struct pollfd pollList[2] = {{STDIN_FILENO, POLLIN, 0}, {sigchldPipe[0], POLLIN, 0}};
+        if (poll(pollList, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (pollList[1].revents & POLLIN)
+        {
+            char buffer[64];
+            while (read(sigchldPipe[0], buffer, sizeof(buffer)) > 0);
+            childSignalled = true;
+            collectBackgroundExits();
+        }
+        //a hangup or error on stdin is left for getline to find
+        if (pollList[0].revents != 0)
+            return;
+    }
+    return;
 }
 
-//reads all aliases from the file specified in tokenList[1]
-//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there are not exactly two tokens
-//throws FILE_ERROR if the file does not exist or cannot be opened
-//throws BAD_FORMAT if any line of the file does not have at least two tokens (key + value)
-void Shell::readAliasFile()
+//sleeps for up to timeout milliseconds (-1 for no limit) until one of the unfinished processes of jobs exits, which shows up on its pidfd, or a SIGCHLD arrives
+//then collects every process whose pidfd is readable, or all of them after a SIGCHLD, since that is the only way to see a stop (or a process with no pidfd)
+//a single poll covers any number of jobs, and nothing is ever collected with wait(-1), so no one else's child is taken by mistake
+void Shell::waitForProcesses(const std::vector<bgJob*>& jobs, int timeout)
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    
-    std::ifstream aliasFile(tokenList[1]);
-    if (!aliasFile)
-        throw error(RETURNCODE::FILE_ERROR);
+    std::vector<struct pollfd> pollList;
+    std::vector<std::pair<bgJob*, int>> owners;
+    for (std::vector<bgJob*>::const_iterator it = jobs.begin(); it != jobs.end(); it++)
+    {
+        std::vector<bgProcess>& processList = (*it)->processList;
+        for (int i = 0; i < processList.size(); i++)
+        {
+            if (processList[i].finished || processList[i].pidfd == -1)
+                continue;
+            struct pollfd entry = {processList[i].pidfd, POLLIN, 0};
+            pollList.push_back(entry);
+            owners.push_back(std::make_pair(*it, i));
+        }
+    }
+    struct pollfd selfPipe = {sigchldPipe[0], POLLIN, 0};
+    pollList.push_back(selfPipe);
     
-    std::string tempLine, tempToken;
-    std::istringstream tokenParser;
+    //EINTR just means a signal got in first, the caller checks its jobs and waits again
+    if (poll(pollList.data(), pollList.size(), timeout) <= 0)
+        return;
     
-    while (getline(aliasFile, tempLine))
+    bool signalled = false;
+    if (pollList.back().revents & POLLIN)
     {
-        //since addNewAlias already exists and has this functionality fully built, including error and duplicate checks,
-        //this function just pushes the alias to tokenList, which is no longer needed, and lets addNewAlias run normally
-        tokenParser.str(tempLine);
-        tokenParser.clear();
-        
-        tokenList.clear();
-        tokenList.push_back(""); //addNewAlias expects that the alias starts in the second index
-        while (tokenParser >> tempToken)
-            tokenList.push_back(tempToken);
-        if (tokenList.size() < 3)
-            throw error(RETURNCODE::BAD_FORMAT);
-        addNewAlias();
+        char buffer[64];
+        while (read(sigchldPipe[0], buffer, sizeof(buffer)) > 0);
+        signalled = true;
+        childSignalled = true;
+        //while the helper thread is running internal commands it may be reading bgJobQueue, so background exits wait for the next reap
+        if (!stageWorker.joinable())
+            collectBackgroundExits();
+    }
+    for (int i = 0; i < owners.size(); i++)
+        if (pollList[i].revents & POLLIN)
+            collectProcess(*owners[i].first, owners[i].second);
+    if (signalled)
+    {
+        for (std::vector<bgJob*>::const_iterator it = jobs.begin(); it != jobs.end(); it++)
+            for (int i = 0; i < (*it)->processList.size(); i++)
+                collectProcess(**it, i);
     }
     return;
 }
 
-void Shell::staticCondExec(Shell* s)
+//runs job in the foreground: with job control it gets the terminal, it is sent SIGCONT if resume is set,
+//and it is waited for until all of its processes have finished or it stops
+//the shell takes the terminal back afterwards along with its own settings, since a program that was stopped (eg an editor) can leave them changed
+//returns true if the job stopped
+bool Shell::waitForJob(bgJob& job, bool resume)
 {
-    s->condExec();
+    bool terminal = jobControl && job.pgid > 0;
+    if (terminal)
+        tcsetpgrp(STDIN_FILENO, job.pgid);
+    if (resume)
+    {
+        job.stopped = false;
+        signalJob(job, SIGCONT);
+    }
+    
+    std::vector<bgJob*> jobs(1, &job);
+    while (job.runningCount > 0 && !job.stopped)
+        waitForProcesses(jobs, -1);
+    
+    if (terminal)
+    {
+        tcsetpgrp(STDIN_FILENO, shellPGID);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shellModes);
+        //the ^C the terminal echoed is still on the line
+        for (int i = 0; i < job.processList.size(); i++)
+        {
+            int status = job.processList[i].status;
+            if (job.processList[i].finished && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+            {
+                std::cout << "\n";
+                break;
+            }
+        }
+    }
+    return job.runningCount > 0;
 }
 
-//calls condChecker to evaluate the condition
-//returns of 1, 2 and 3 indicate success conditions
-//then recreates the tokenList with just the command to run
-//and calls execCommand again
-//throws TOO_FEW_ARGS if there is not at least one argument to pass to execCommand
-void Shell::condExec()
+//sends sig to every process of job that hasn't finished
+//a job with its own process group gets it through the group, whose ID can't be reused while any process in it is still uncollected
+//otherwise each process gets it through its pidfd, last command first, since killing the first one lets the next carry on straight away
+void Shell::signalJob(bgJob& job, int sig)
 {
-    //since condChecker accepts three formats, with and without parentheses, the return value on success is captured
-    //1 means we cut out tokens 1 through 5
-    //2 and 3 mean we only cut 1 through 3
-    int format = condChecker();
-    if (format == 1)
+    if (job.pgid > 0)
     {
-        //erase() causes a segfault on undefined ranges, so must explicitly check that sufficient args exist
-        if (tokenList.size() < 5)
-            throw error(RETURNCODE::TOO_FEW_ARGS);
-        
-        tokenList.erase(tokenList.begin(), tokenList.begin() + 5);
-        execCommand();
+        kill(-job.pgid, sig);
+        return;
     }
-    else if (format == 2 || format == 3)
+    for (int i = (int) job.processList.size() - 1; i >= 0; i--)
     {
-        if (tokenList.size() < 3)
-            throw error(RETURNCODE::TOO_FEW_ARGS);
-        
-        tokenList.erase(tokenList.begin(), tokenList.begin() + 3);
-        execCommand();
+        bgProcess& process = job.processList[i];
+        if (process.finished)
+            continue;
+        if (process.pidfd == -1 || sendPidfdSignal(process.pidfd, sig) == -1)
+            kill(process.pid, sig);
     }
     return;
 }
 
-void Shell::staticReverseCondExec(Shell* s)
+//keeps a finished job for the jobstats command, dropping the oldest one if the list is full
+void Shell::addJobToStats(const bgJob& job)
 {
-    s->reverseCondExec();
+    if (jobStatsList.size() == JOB_STATS_SIZE)
+        jobStatsList.pop_front();
+    jobStatsList.push_back(job);
+    return;
 }
 
-//calls condChecker to evaluate the condition
-//returns of -1, -2 and -3 indicate success conditions
-//then recreates the tokenList with just the command to run
-//and calls execCommand again
-//throws TOO_FEW_ARGS if there is not at least one argument to pass to execCommand
-void Shell::reverseCondExec()
+//reads the cond or notcond at tokenList[pos] into guard, in any of three formats:
+// ( condition file ) uses 5 tokens
+// (condition file) uses 3 tokens
+// condition file uses 3 tokens
+//returns the number of tokens used
+//throws TOO_FEW_ARGS if the condition is cut short, BAD_SYNTAX if it cannot detect one of these three formats, INVALID_ARG for an unknown condition
+int Shell::parseGuard(int pos, condGuard& guard)
 {
-    //since condChecker accepts three formats, with and without parentheses, the return value on success is captured
-    //-1 means we cut out tokens 1 through 5
-    //-2 and -3 mean we only cut 1 through 3
-    int format = condChecker();
-    if (format == -1)
+    guard.negated = (tokenList[pos] == "notcond");
+    if (tokenList.size() < pos + 3)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    int used;
+    if (tokenList[pos + 1] == "(")
     {
-        if (tokenList.size() < 5)
+        if (tokenList.size() < pos + 5)
             throw error(RETURNCODE::TOO_FEW_ARGS);
         
-        tokenList.erase(tokenList.begin(), tokenList.begin() + 5);
+        if (tokenList[pos + 4] != ")")
+            throw error(RETURNCODE::BAD_SYNTAX);
         
-        execCommand();
+        guard.condition = tokenList[pos + 2];
+        guard.file = tokenList[pos + 3];
+        used = 5;
     }
-    else if (format == -2 || format == -3)
+    else if (!tokenList[pos + 1].empty() && tokenList[pos + 1][0] == '(')
     {
-        if (tokenList.size() < 3)
-            throw error(RETURNCODE::TOO_FEW_ARGS);
+        if (tokenList[pos + 2].empty() || tokenList[pos + 2].back() != ')')
+            throw error(RETURNCODE::BAD_SYNTAX);
         
-        tokenList.erase(tokenList.begin(), tokenList.begin() + 3);
+        guard.condition = tokenList[pos + 1].substr(1); //cutting off the ( character
+        guard.file = tokenList[pos + 2];
+        guard.file.pop_back(); //to delete the ) character from the end
+        used = 3;
+    }
+    else
+    {
+        if ((tokenList.size() > pos + 3 && tokenList[pos + 3] == ")") || (!tokenList[pos + 2].empty() && tokenList[pos + 2].back() == ')'))
+            throw error(RETURNCODE::BAD_SYNTAX);
         
-        execCommand();
+        guard.condition = tokenList[pos + 1];
+        guard.file = tokenList[pos + 2];
+        used = 3;
     }
-    return;
+    
+    if (guard.condition != "checke" && guard.condition != "checkd" && guard.condition != "checkr" && guard.condition != "checkw" && guard.condition != "checkx")
+        throw error(RETURNCODE::INVALID_ARG);
+    return used;
 }
 
-void Shell::runChildProcess(int index)
+//evaluates a guard when its command is about to run, so the file is checked as it is at that moment
+//a file that doesn't exist fails every condition
+bool Shell::checkGuard(const condGuard& guard)
 {
-    std::istringstream parser;
-    std::string currentDirectory;
-    char* pathVar = getenv("PATH");
+    struct stat fileStruct;
+    bool result = false;
+    if (stat(guard.file.c_str(), &fileStruct) == 0)
+    {
+        if (guard.condition == "checke")
+            result = S_ISREG(fileStruct.st_mode);
+        else if (guard.condition == "checkd")
+            result = S_ISDIR(fileStruct.st_mode);
+        else if (guard.condition == "checkr")
+            result = (S_IRUSR & fileStruct.st_mode) == S_IRUSR;
+        else if (guard.condition == "checkw")
+            result = (S_IWUSR & fileStruct.st_mode) == S_IWUSR;
+        else if (guard.condition == "checkx")
+            result = (S_IXUSR & fileStruct.st_mode) == S_IXUSR;
+    }
+    return result != guard.negated;
+}
+
+//returns the full path of the given linux command, or an empty string if it isn't in any $PATH directory
+//lookups go through commandHashTable first, so $PATH is only searched the first time a command is used
+//the table is thrown away whenever $PATH changes, since any of the remembered paths could now be wrong
+//a remembered path is checked before it is used, like bash does, and one that has gone is forgotten and $PATH searched again,
+//so a command that has been moved or removed from an earlier directory is still found in a later one the first time
+//names containing a / are paths already and are never searched or remembered
+std::string Shell::findCommandPath(std::string command)
+{
+    if (command.find('/') != std::string::npos)
+        return command;
+    
+    const char* pathVar = getenv("PATH");
+    std::string currentPath = (pathVar == NULL) ? "" : pathVar;
+    if (currentPath != hashedPathVar)
+    {
+        commandHashTable.clear();
+        hashedPathVar = currentPath;
+    }
     
-    parser.str(pathVar);
-    parser.clear();
+    std::unordered_map<std::string, std::string>::iterator it = commandHashTable.find(command);
+    if (it != commandHashTable.end())
+    {
+        if (access(it->second.c_str(), X_OK) == 0)
+            return it->second;
+        commandHashTable.erase(it);
+    }
     
+    std::istringstream parser(currentPath);
+    std::string currentDirectory;
     while (getline(parser, currentDirectory, ':'))
     {
-        std::string fullFileName = currentDirectory + '/' + childSubCommands[index][0];
+        std::string fullFileName = currentDirectory + '/' + command;
         if (access(fullFileName.c_str(), X_OK) == 0)
         {
-            //argv has to be two larger than the tokenList: 1 for the directory, 1 for null
-            //eg "ls -l" becomes "/usr/bin/ls", "ls", "-l", NULL
-            char** argv = new char*[childSubCommands[index].size() + 2];
-            
-            argv[0] = strdup(fullFileName.c_str());
-            argv[1] = strdup(childSubCommands[index][0].c_str());  //setting the name for the new process
-            
-            for (int i = 1; i < childSubCommands[index].size(); i++)
-            {
-                //i + 1
-                argv[i+1] = strdup(childSubCommands[index][i].c_str());
-            }
-            argv[childSubCommands[index].size() + 1] = NULL;
-            execve(argv[0], &argv[1], environ);
-            delete [] argv; //if execve failed, I need to explicitly free all memory and exit
-            std::exit(0);
+            commandHashTable[command] = fullFileName;
+            return fullFileName;
         }
     }
-    //if it makes it to this point, then the command was not found in any $PATH directory
-    std::cerr << "Command not found\n";
-    std::exit(0);
-    return;
+    return "";
 }
 
-void Shell::staticRunLinuxCommand(Shell* s)
+//copies everything from inFD to outFD without going through a user space buffer
+//copy_file_range handles file to file, splice handles anything where one end is a pipe, and sendfile handles a file to anything else
+//each one is tried in that order and the next takes over if the kernel refuses; since the file offsets advance as data moves, a later method just carries on from wherever the earlier one stopped
+//plain read and write is the last resort, eg for a terminal on both ends
+//returns false if the data couldn't be moved at all
+bool Shell::transferData(int inFD, int outFD)
 {
-    s->runLinuxCommand();
-}
-
-//passes the input as originally given to the OS
-void Shell::runLinuxCommand()
-{
-    if (tokenList.size() < 1)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-        
-    parseRedirection(); //first check for redirection or piping
+    struct stat inStat, outStat;
+    if (fstat(inFD, &inStat) == -1 || fstat(outFD, &outStat) == -1)
+        return false;
+    bool inPipe = S_ISFIFO(inStat.st_mode);
+    bool outPipe = S_ISFIFO(outStat.st_mode);
+    ssize_t moved;
     
-    pid_t child;
-    std::vector<pid_t> childList;
-    int returnValue;
+    if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode))
+    {
+        while ((moved = copy_file_range(inFD, NULL, outFD, NULL, TRANSFER_CHUNK_SIZE, 0)) > 0);
+        if (moved == 0)
+            return true;
+    }
+    
+    if (inPipe || outPipe)
+    {
+        while ((moved = splice(inFD, NULL, outFD, NULL, TRANSFER_CHUNK_SIZE, SPLICE_F_MOVE)) > 0);
+        if (moved == 0)
+            return true;
+    }
     
-    //using a 2D array to hold the file descriptors for the pipes
-    std::deque<int*> pipes;
-    int* cmdPipe;
+    if (!inPipe)
+    {
+        while ((moved = sendfile(outFD, inFD, NULL, TRANSFER_CHUNK_SIZE)) > 0);
+        if (moved == 0)
+            return true;
+    }
     
-    for (int i = 0; i < childSubCommands.size(); i++)
+    std::vector<char> buffer(TRANSFER_CHUNK_SIZE);
+    while ((moved = read(inFD, buffer.data(), buffer.size())) > 0)
     {
-        //IF ONLY ONE COMMAND:
-        if (childSubCommands.size() == 1)
+        for (ssize_t written = 0; written < moved; )
         {
-            child = fork();
-            
-            if (child == 0)
-            {
-                runChildProcess(0);
-            }
-            else
-                childList.push_back(child);
+            ssize_t result = write(outFD, buffer.data() + written, moved - written);
+            if (result == -1)
+                return false;
+            written += result;
         }
-        else
+    }
+    return moved == 0;
+}
+
+//MAIN PROGRAM FUNCTIONS
+
+//outputs toyshell[1]> (or whatever the values are at the time)
+void Shell::printCommandLine()
+{
+    if (batchMode)
+        return;
+    std::cout << shellName << "[" << commandCount << "]" << shellDelimiter;
+    return;
+}
+
+//removes leading whitespace from command line
+//doesn't remove trailing, because that gets ignored anyway when reading into the deque
+//NO LONGER USED, as gcc < 4.9 doesn't know how to handle regex
+//i've left it in for now so I can refer back to it later
+void Shell::parseCommandLineWhitespace()
+{
+        currentLine = std::regex_replace(currentLine, std::regex("^\\s* | \\s*$"), std::string(""));
+}
+
+//if there is a currently executing script (scriptStack not empty), reads the next line of the script at the front of the stack
+//a script that has run out of lines is closed, and the one under it carries on, until the stack is empty and input comes from the command line again
+//otherwise gets whatever is on the current command line (or the next line of batch input) - can be blank
+//the end of the input is the same as stop, so it sets stopRequested
+//return value is false if the line was blank or if there was nothing left to read, true otherwise
+bool Shell::readCommandLine()
+{
+    std::cin.clear();
+    
+    currentCompiled = NULL;
+    bool fromScript = false;
+    while (scriptStack.size() != 0)
+    {
+        if (readScriptLine(*scriptStack[0]))
         {
-            //IF FIRST OF CHAIN
-            if (i == 0)
-            {
-                cmdPipe = new int[2];
-                pipe(cmdPipe);
-                pipes.push_back(cmdPipe);
-                
-                child = fork();
-                
-                if (child == 0)
-                {
-                    dup2(pipes[0][1], STDOUT_FILENO);
-                    close(pipes[0][0]);
-                    close(pipes[0][1]);
-                    runChildProcess(0);
-                }
-                else
-                    childList.push_back(child);
-            }
-            //IF LAST OF CHAIN
-            else if (i == childSubCommands.size() - 1)
-            {
-                child = fork();
-                
-                if (child == 0)
-                {
-                    dup2(pipes[0][0], STDIN_FILENO);
-                    close(pipes[0][0]);
-                    close(pipes[0][1]);
-                    runChildProcess(i);
-                }
-                else
-                {
-                    childList.push_back(child);
-                    close(pipes[0][0]);
-                    close(pipes[0][1]);
-                    pipes.pop_front();
-                }
-            }
-            else
-            {
-                //IF MIDDLE OF CHAIN
-                cmdPipe = new int[2];
-                pipe(cmdPipe);
-                pipes.push_back(cmdPipe);
-                
-                child = fork();
-                
-                if (child == 0)
-                {
-                    dup2(pipes[0][0], STDIN_FILENO);
-                    dup2(pipes[1][1], STDOUT_FILENO);
-                    close(pipes[0][0]);
-                    close(pipes[0][1]);
-                    close(pipes[1][0]);
-                    close(pipes[1][1]);
-                    runChildProcess(i);
-                }
-                else
-                {
-                    childList.push_back(child);
-                    
-                    //we no longer need the first pipe in the list - close and remove
-                    close(pipes[0][0]);
-                    close(pipes[0][1]);
-                    pipes.pop_front();
-                }
-            }
+            fromScript = true;
+            break;
         }
+        popScript();
     }
     
-    if (backgroundMode)
+    //script and batch lines don't go into the history
+    NOHISTORYFLAG = fromScript || batchMode;
+    if (fromScript)
     {
-        addJobToBGQueue(childList);
+        if (!batchMode)
+            std::cout << currentLine << std::endl;  //printing out the command that is going to be executed
+    }
+    else if (batchMode)
+    {
+        if (!readBatchLine(currentLine))
+        {
+            stopRequested = true;
+            return false;
+        }
     }
     else
     {
-        for (int i = 0; i < childList.size(); i++)
+        waitForInput();
+        if (!getline(std::cin, currentLine))
         {
-            //this do loop is required when running multiple children
-            //depending on the way they are scheduled, we might get returned a false error value: EINTR
-            do
-            {
-                //using waitpid for the specific child, because otherwise it will wait for the first job to end
-                //which wouldn't necessarily be this one, as other background jobs might end first
-                waitpid(childList[i], &returnValue, 0);
-            } while (errno == EINTR);
-            if (returnValue != 0)
-            {
-                throw error(RETURNCODE::PROCESS_ERROR);
-            }
+            //ctrl-d, or the end of whatever was piped in, ends the shell rather than leaving it reading nothing forever
+            std::cout << "\n";
+            stopRequested = true;
+            return false;
         }
     }
     
+    //compiled lines were already stripped and tokenized when they were compiled
+    if (currentCompiled != NULL)
+        return true;
+    
+    //this erases any comments from the string, trims blanks from both ends and between words, and splits it into words
+    //a $ inside quotes isn't a comment, and a ! has to be unquoted to mean history
+    //note that if $ is the first non-space character that occurs, the whole string gets erased
+    //and the line is treated as though return was hit on a blank line
+    lexLine(currentLine, lexed, true);
+    currentLine.assign(lexed.text);
+    
+    if (currentLine[0] == '!')
+    {
+        replaceWithHistory();
+        //the line from history still has to be split into words
+        lexLine(currentLine, lexed, true);
+        currentLine.assign(lexed.text);
+    }
+    //note that the replaceWithHistory command runs immediately - anything beginning with a ! is assumed to be this command and the appropriate history is inserted before continuing
+    
+    return currentLine != "";
+}
+
+//reads the next line of batch input into line, without the newline
+//reads from batchFD in blocks of at least SCRIPT_BUFFER_SIZE, growing the buffer if a single line doesn't fit
+//the last line doesn't need a newline
+bool Shell::readBatchLine(std::string& line)
+{
+    while (true)
+    {
+        char* start = batchBuffer.data() + batchStart;
+        char* newline = (char*) memchr(start, '\n', batchEnd - batchStart);
+        if (newline != NULL)
+        {
+            line.assign(start, newline);
+            batchStart += newline - start + 1;
+            return true;
+        }
+        if (batchFD == -1)
+        {
+            if (batchStart == batchEnd)
+                return false;
+            line.assign(start, batchEnd - batchStart);
+            batchStart = batchEnd;
+            return true;
+        }
+        
+        //move the unfinished line to the front and fill the rest of the buffer
+        memmove(batchBuffer.data(), start, batchEnd - batchStart);
+        batchEnd -= batchStart;
+        batchStart = 0;
+        if (batchBuffer.size() - batchEnd < SCRIPT_BUFFER_SIZE)
+            batchBuffer.resize(batchEnd + SCRIPT_BUFFER_SIZE);
+        ssize_t bytes = read(batchFD, batchBuffer.data() + batchEnd, batchBuffer.size() - batchEnd);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            if (batchFD != STDIN_FILENO)
+                close(batchFD);
+            batchFD = -1;
+        }
+        else
+            batchEnd += bytes;
+    }
+}
+
+void Shell::setBatchInput(int fd)
+{
+    batchFD = fd;
     return;
 }
 
-//I didn't actually implement this yet, partly because it wouldn't have been used anyway since we were given a script to run
-//and also because I thought this might make a decent contender for the "add a new function" portion of assignment 2
-//the intention is for the "man" command to print usage info for all internal functions
-//if the argument isn't an internal function, it passes it onto the OS as usual
+void Shell::setBatchCommand(std::string commands)
+{
+    batchBuffer.assign(commands.begin(), commands.end());
+    batchStart = 0;
+    batchEnd = batchBuffer.size();
+    batchFD = -1;
+    return;
+}
 
-void Shell::staticInfoCommand(Shell* s)
+int Shell::getExitStatus()
 {
-    s->infoCommand();
+    return exitStatus;
 }
 
-//print usage info for the given command
-//if it's not one of my commands, pass it on to linux
-void Shell::infoCommand()
+//opens the [ and ] files of every stage of tree
+//the files are opened here so that errors are caught before anything is started, but they are only kept in stageInputFDs and stageOutputFDs
+//a [ or ] belongs to whichever command in the chain it appears in, and replaces that command's pipe
+//so the shell's own stdin and stdout are never touched
+//throws FILE_ERROR if a file can't be opened
+void Shell::openRedirectionFiles(const commandTree& tree)
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    
-    //if the second command maps to an internal command, found in infoMap, then it prints the value
-    //otherwise it runs a regular linux command and lets the real man function handle it
-    std::map<std::string, std::string>::iterator it = infoMap.find(tokenList[1]);
-    if (it != infoMap.end())
+    closeRedirectionFiles();
+    int file;
+    for (int i = 0; i < tree.stages.size(); i++)
     {
-        std::cout << "======================================\n";
-        std::cout << it->second;
-        std::cout << "======================================\n";
+        const commandStage& stage = tree.stages[i];
+        stageInputFDs.push_back(-1);
+        stageOutputFDs.push_back(-1);
+        
+        //open the [ file for reading, it becomes stdin for this command
+        //O_CLOEXEC so that only the command it is duplicated into keeps a copy
+        if (stage.inputFile != "")
+        {
+            file = open(stage.inputFile.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file == -1)
+                throw error(RETURNCODE::FILE_ERROR);
+            stageInputFDs.back() = file;
+        }
+        //open the ] file for writing, it becomes stdout for this command
+        if (stage.outputFile != "")
+        {
+            file = open(stage.outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (file == -1)
+                throw error(RETURNCODE::FILE_ERROR);
+            stageOutputFDs.back() = file;
+        }
     }
-    else
-        runLinuxCommand();
-    return;
 }
 
-//main driver
-//calls the other functions in order
-//does not throw any exceptions
-void Shell::run()
+//splits the words of tree into the commands of an @ chain, along with the [ and ] file names that belong to each
+//doesn't open anything, so the result stays in the tree and is reused every time it runs
+//throws TOO_FEW_ARGS if a [ or ] has no file name after it, RECURSIVE_REDIRECTION if a ] names the file a [ already read from
+//throws BAD_SYNTAX if a command in the chain is empty, eg "ls @ @ wc"
+void Shell::splitStages(commandTree& tree)
 {
-    try
+    const std::deque<std::string>& words = tree.words;
+    std::vector<commandStage>& stages = tree.stages;
+    stages.clear();
+    stages.push_back(commandStage());
+    stages.back().words.push_back(words[0]);
+    std::string inputFileName = "";
+    
+    //since the first token can't be either [ or ], I start at index 1 to avoid potentially empty commands once the file names are removed
+    //if the first token is a [ or ], it will give an error when trying to run the command anyway
+    for (int i = 1; i < words.size(); i++)
     {
-        //while command line is empty, print name, counter, delim
-        //then read command line
-        printCommandLine();
-        while (!readCommandLine())
+        //a quoted [ ] or @ is an ordinary argument
+        bool operatorToken = !tree.quoted[i];
+        if (operatorToken && words[i] == "[")
         {
-            printCommandLine();
+            //next index must exist
+            if (words.size() < (i + 2))
+                throw error(RETURNCODE::TOO_FEW_ARGS);
+            inputFileName = words[i+1];
+            stages.back().inputFile = inputFileName;
+            i++; //we already handled the next token - the file name
         }
-        
-        if (!NOHISTORYFLAG)
-            addCommandToHistory();
-        
-        
-        //tokenize
-        parseCommandLine();
-        
-        //output commands get interrupted and returned to main
-        //would just be a waste of cycles to go through the rest of the process
-        //however, since it can be called by other functions (notably cond and notcond), it does exist as a separate function
-        if (tokenList[0] == "output")
+        else if (operatorToken && words[i] == "]")
         {
-            output();
+            if (words.size() < (i + 2))
+                throw error(RETURNCODE::TOO_FEW_ARGS);
+            if (words[i+1] == inputFileName)
+                throw error(RETURNCODE::RECURSIVE_REDIRECTION);
+            stages.back().outputFile = words[i+1];
+            i++;
         }
-        
-        //newname is special in that it should not substitute any aliases
-        //this allows both the entry of aliases that refer to other aliases that would otherwise get resolved out as well as the deletion of existing aliases
-        //it should also not delete the background operator (-)
-        if (tokenList[0] != "newname")
+        else if (operatorToken && words[i] == "@")
         {
-            parseAliases();
-            
-            if (tokenList.back().back() == '-')
-                backgroundMode = true;
-            
-            if (backgroundMode)
-            {
-                if (tokenList.back() == "-")
-                    tokenList.pop_back();
-                else
-                    tokenList.back().pop_back();
-                
-                if (tokenList.empty())
-                    throw error(RETURNCODE::TOO_FEW_ARGS);
-            }
+            if (stages.back().words.empty())
+                throw error(RETURNCODE::BAD_SYNTAX);
+            stages.push_back(commandStage());
         }
-          
-        
-        //determine command and run it
-        execCommand();
-        
-        if (scriptStack.size() != 0)
-            if (scriptStack[0].size() == 1)
-                scriptStack.pop_front();
-    }
-    catch (error const &e)
-    {
-        if (e.errorCode != RETURNCODE::OUTPUT_COMMAND)
+        else
         {
-            //since I am interpreting the instructions as fully exiting all scripts when any error occurs, this clears the queue and rethrows to main
-            //many of these functions can produce errors, all of these get passed back to main and handled there
-            scriptStack.clear();
-            NOHISTORYFLAG = false;
+            if (operatorToken && words[i] == "$?")
+                stages.back().statusWords.push_back((int) stages.back().words.size());
+            stages.back().words.push_back(words[i]);
         }
-        throw e;
     }
-    
+    if (stages.back().words.empty())
+        throw error(RETURNCODE::BAD_SYNTAX);
+    for (std::vector<commandStage>::iterator it = stages.begin(); it != stages.end(); it++)
+    {
+        it->utility = findUtility(it->words[0]);
+        const builtinCommand* builtin = findBuiltin(it->words[0]);
+        if (builtin != NULL && builtin->pipeStage)
+            it->builtin = builtin;
+    }
+    tree.stagesSplit = true;
     return;
 }
 
-void Shell::staticBringJobToFG(Shell* s)
+void Shell::parseCommandLine()
 {
-    s->bringJobToFG();
+    //readCommandLine already split the line with the lexer, and left currentLine with single spaces between the words
+    //so this just copies the words into tokenList, the one copy they get (after this they are moved into their command's tree)
+    setTokens();
+    return;
 }
 
-void Shell::bringJobToFG()
+void Shell::setTokens()
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    else if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    
-    int id, status;
-    std::vector<pid_t> jobPIDList;
-    try
-    {
-        id = stoi(tokenList[1]);
-    }
-    catch (std::exception &e)
+    tokenList.clear();
+    tokenQuoted.clear();
+    for (int i = 0; i < lexed.tokens.size(); i++)
     {
-        //if the second arg is not an integer, stoi will throw an exception
-        throw error(RETURNCODE::INVALID_ARG);
+        tokenList.push_back(std::string(lexed.tokens[i]));
+        tokenQuoted.push_back(lexed.quoted[i]);
     }
-    
-    //try to find the job in the map
-    //if it exists, get the list of pids and wait for each
-    //otherwise throw an exception
-    std::map<int, bgJob>::iterator it = bgJobQueue.find(id);
-    if (it == bgJobQueue.end())
-        throw error(RETURNCODE::NO_JOB);
-    
-    jobPIDList = it->second.pidList;
-    bgJobQueue.erase(it);
-    for (int i = 0; i < jobPIDList.size(); i++)
-        waitpid(jobPIDList[i], &status, 0);
+    return;
 }
 
-void Shell::staticPrintBGJobs(Shell* s)
+//tokenQuoted isn't filled in for every way tokenList gets built (eg internal commands that make their own), so anything past its end counts as unquoted
+bool Shell::tokenIsQuoted(int i)
 {
-    s->printBGJobs();
+    return i < tokenQuoted.size() && tokenQuoted[i];
 }
 
-//prints the Job ID, PID for the first child process in the list (since piped commands might have more than one), the original command, status for the last process in the list and start time
-//throws TOO_MANY_ARGS if there is not exactly one argument (the backjobs command itself)
-void Shell::printBGJobs()
+bool Shell::isOperator(int i, std::string op)
 {
-    if (tokenList.size() > 1)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
-    
-    std::vector<int> markForDeletion;
-    
-    int status;
-    std::string statString;
-    pid_t lastPID;  //used to check the status for the final process in the list
-    std::vector<pid_t> PIDList;
-    std::cout << "Job | PID |  Command  | Status |   Start Time\n";
-    for (std::map<int, bgJob>::iterator i = bgJobQueue.begin(); i != bgJobQueue.end(); i++)
+    return tokenList[i] == op && !tokenIsQuoted(i);
+}
+
+//loops through the input string, assumed to be in tokenList, and replaces each alias with its full expansion
+//quoted words are left alone
+//expansions are worked out when first needed and remembered until one of the aliases they went through changes,
+//and addNewAlias never lets a cycle into the aliases, so there is nothing to check here
+//does not throw
+void Shell::parseAliases()
+{
+    std::deque<std::string> expanded;
+    std::deque<bool> expandedQuoted;
+    for (int i = 0; i < tokenList.size(); i++)
     {
-        bgJob cur = i->second;
-        PIDList = cur.pidList;
-        lastPID = waitpid(PIDList[PIDList.size() - 1], &status, WNOHANG);
-        if (lastPID == PIDList[PIDList.size() - 1] || lastPID == -1)
+        //quoting a word is the way to stop it being replaced, like in other shells
+        std::unordered_map<std::string, aliasIterator>::iterator found = tokenIsQuoted(i) ? aliasIndex.end() : aliasIndex.find(tokenList[i]);
+        if (found == aliasIndex.end())
         {
-            statString = "Stopped";
-            markForDeletion.push_back(i->first);
+            expanded.push_back(std::move(tokenList[i]));
+            expandedQuoted.push_back(tokenIsQuoted(i));
         }
         else
-            statString = "Running";
-        std::cout << std::setw(3) << cur.jobID << std::setw(7) << PIDList[0] << std::setw(10) << cur.cmd << std::setw(11) << statString << std::setw(28) << ctime(&cur.startTime); //ctime ends with \n, so no endl here
+        {
+            const std::deque<std::string>& expansion = expandAlias(tokenList[i]);
+            expanded.insert(expanded.end(), expansion.begin(), expansion.end());
+            expandedQuoted.insert(expandedQuoted.end(), expansion.size(), false);
+            useAlias(found->second);
+        }
     }
+    tokenList.swap(expanded);
+    tokenQuoted.swap(expandedQuoted);
+    return;
+}
+
+//returns the alias fully expanded, ie with every token of its value that is itself an alias replaced by that alias's expansion
+//assumes key is an alias, and that there are no cycles
+const std::deque<std::string>& Shell::expandAlias(std::string key)
+{
+    std::unordered_map<std::string, std::deque<std::string>>::iterator cached = aliasExpansions.find(key);
+    if (cached != aliasExpansions.end())
+        return cached->second;
     
-    //I didn't want to deal with erasing values while running iterators, so I add all stopped jobs to a vector, and erase them after
-    for (int i = 0; i < markForDeletion.size(); i++)
+    std::deque<std::string> expansion;
+    const std::deque<std::string>& alias = *aliasIndex[key];
+    for (int i = 1; i < alias.size(); i++)
     {
-        std::map<int, bgJob>::iterator it = bgJobQueue.find(markForDeletion[i]);
-        bgJobQueue.erase(it);
+        if (aliasIndex.count(alias[i]) == 0)
+            expansion.push_back(alias[i]);
+        else
+        {
+            const std::deque<std::string>& inner = expandAlias(alias[i]);
+            expansion.insert(expansion.end(), inner.begin(), inner.end());
+        }
     }
-    
+    return aliasExpansions[key] = expansion;
 }
 
-void Shell::staticCull(Shell* s)
+//starts the history entry for whatever was on the input line, minus leading and trailing spaces
+//the entry is only written once the command finishes, since that is when its status and duration are known
+void Shell::addCommandToHistory()
 {
-    s->cull();
+    pendingHistoryNumber = commandCount;
+    pendingHistory.time = time(NULL);
+    pendingHistory.command = currentLine;
+    clock_gettime(CLOCK_MONOTONIC, &historyClock);
+    historyPending = true;
+    return;
 }
 
-//kill the process (which might actually be a list of processes) specified by the internal Job ID
-//requires exactly two tokens, first is the cull command itself, second is an integer
-//throws an error if there are not exactly two tokens, or if the second token cannot be resolved to int
-//also throws NO_JOB if the job ID is not found in the map
-void Shell::cull()
+//appends the entry started by addCommandToHistory to the history file, now that the command has finished
+//the whole line goes out in one write, and the file is opened with O_APPEND, so shells sharing the file don't mix up each other's lines
+//does not throw, since failing to save history shouldn't stop the command
+void Shell::finishHistoryEntry(int status)
 {
-    if (tokenList.size() < 2)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    else if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
+    if (!historyPending)
+        return;
+    historyPending = false;
     
-    int jobID;
-    try
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pendingHistory.status = status;
+    pendingHistory.duration = elapsedSeconds(historyClock, now);
+    pushHistorySlot(pendingHistoryNumber, pendingHistory);
+    if (!openHistoryFile())
+        return;
+    
+    std::ostringstream line;
+    line << pendingHistory.time << " " << status << " " << std::fixed << std::setprecision(3) << pendingHistory.duration << " " << pendingHistory.command << "\n";
+    std::string record = line.str();
+    if (write(historyFD, record.data(), record.size()) == -1)
+        perror("history");
+    return;
+}
+
+//adds an entry to the newest end of the history ring, overwriting the oldest if it is full
+//the command is interned, so only a command that isn't already in the ring needs any memory
+void Shell::pushHistorySlot(int number, const historyRecord& record)
+{
+    if (historyRing.empty())
+        return;
+    //a command that fails before it runs (eg a bad alias) doesn't use up its number, so the next command shows the same one in the prompt
+    //the newer command replaces it, so each number is only in the ring once
+    if (historyCount > 0 && historyRing[(historyHead + historyCount - 1) % historyRing.size()].number == number)
     {
-        jobID = stoi(tokenList[1]);
+        historyCount--;
+        releaseHistoryString(historyRing[(historyHead + historyCount) % historyRing.size()].command);
     }
-    catch (std::exception &e)
+    if (historyCount == historyRing.size())
     {
-        //if the second arg is not an integer, stoi will throw an exception
-        throw error(RETURNCODE::INVALID_ARG);
+        releaseHistoryString(historyRing[historyHead].command);
+        historyHead = (historyHead + 1) % historyRing.size();
+        historyCount--;
     }
     
-    //try to find the job in the map
-    //if it exists, get the list of pids and kill each
-    //otherwise throw an exception
-    std::map<int, bgJob>::iterator it = bgJobQueue.find(jobID);
-    if (it == bgJobQueue.end())
-        throw error(RETURNCODE::NO_JOB);
+    std::unordered_map<std::string, int>::iterator interned = historyStrings.insert(std::make_pair(record.command, 0)).first;
+    interned->second++;
     
-    std::vector<pid_t> jobList = it->second.pidList;
-    std::string systemCMD;
-    //iterating in reverse order bc killing the first process allows the second to proceed immediately
-    for (int i = (int) jobList.size() - 1; i >=0; i--)
-    {
-        systemCMD = "kill " + std::to_string((int)jobList[i]);
-        system(systemCMD.c_str());
-    }
+    historySlot& slot = historyRing[(historyHead + historyCount) % historyRing.size()];
+    slot.number = number;
+    slot.time = record.time;
+    slot.status = record.status;
+    slot.duration = record.duration;
+    slot.command = &interned->first; //keys of an unordered_map never move, so the pointer stays good until it is erased
+    historyCount++;
     return;
 }
 
-void Shell::staticUsescript(Shell* s)
+void Shell::releaseHistoryString(const std::string* command)
 {
-    s->usescript();
+    std::unordered_map<std::string, int>::iterator interned = historyStrings.find(*command);
+    if (interned != historyStrings.end() && --interned->second == 0)
+        historyStrings.erase(interned);
+    return;
 }
 
-//adds a new entry to the member variable scriptStack (a 2D deque)
-//this new entry will itself be a queue of the commands in the file, followed by the file name
-//so queue[i][0 - (size -2)] are the commands and queue[i][size - 1] is the name, used to check for recursion
-void Shell::usescript()
+//returns the slot holding the command numbered number, or NULL if it isn't in the ring
+//numbers only go up, and usually each slot is one more than the last, so the slot is first looked for by counting back from the newest
+//script lines take numbers without going into the history, so if there was a gap it falls back to a binary search
+const historySlot* Shell::findHistorySlot(int number)
 {
-    if (tokenList.size() < 1)
-        throw error(RETURNCODE::TOO_FEW_ARGS);
-    if (tokenList.size() > 2)
-        throw error(RETURNCODE::TOO_MANY_ARGS);
+    if (historyCount == 0)
+        return NULL;
     
-    std::string scriptname = tokenList[1];
-    //first check to see if the new script is already in the script queue
-    //if it is, the script is recursive (this works for both self-recursion or mutual-recursion)
-    for (int i = 0; i < scriptStack.size(); i++)
+    size_t size = historyRing.size();
+    const historySlot& newest = historyRing[(historyHead + historyCount - 1) % size];
+    if (number > newest.number || number < historyRing[historyHead].number)
+        return NULL;
+    long back = newest.number - number;
+    if (back < historyCount)
     {
-        if (scriptname == scriptStack[i][scriptStack[i].size() - 1])
-        {
-            throw error(RETURNCODE::RECURSIVE_SCRIPT);
-        }
+        const historySlot& guess = historyRing[(historyHead + historyCount - 1 - back) % size];
+        if (guess.number == number)
+            return &guess;
     }
     
-    std::ifstream file(scriptname);
-    if (!file)
-        throw error (RETURNCODE::FILE_ERROR);
-    
-    std::deque<std::string> newScript;
-    std::string command;
-    while (getline(file, command))
+    size_t low = 0, high = historyCount;
+    while (low < high)
     {
-        newScript.push_back(command);
+        size_t middle = (low + high) / 2;
+        if (historyRing[(historyHead + middle) % size].number < number)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < historyCount && historyRing[(historyHead + low) % size].number == number)
+        return &historyRing[(historyHead + low) % size];
+    return NULL;
+}
+
+//prints a slot the same way printHistoryEntry prints an entry of the history file, but numbered as in the prompt
+void Shell::printHistorySlot(const historySlot& slot)
+{
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&slot.time));
+    std::cout << slot.number << ": " << date << std::setw(5) << slot.status << std::fixed << std::setprecision(3) << std::setw(10) << slot.duration << "s  " << *slot.command << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+    return;
+}
+
+//opens the history file for appending and reading, creating it if needed
+//if it can't be opened (eg a read-only home directory), history for this session is kept in a memfd instead, so everything else works the same
+//returns false only if neither works
+bool Shell::openHistoryFile()
+{
+    if (historyFD != -1)
+        return true;
+    historyFD = open(historyFileName.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (historyFD == -1)
+        historyFD = memfd_create("history", MFD_CLOEXEC);
+    return historyFD != -1;
+}
+
+//brings the index up to date with the history file, which may have grown from this shell or any other using the same file
+//only the part of the file that hasn't been indexed yet is read, so after the first call this is cheap
+//the file is mapped read-only and remapped whenever it grows, and only complete lines are indexed
+void Shell::indexHistory()
+{
+    struct stat fileStruct;
+    if (!openHistoryFile() || fstat(historyFD, &fileStruct) == -1 || fileStruct.st_size <= historyIndexedSize)
+        return;
+    
+    if (historyMap != NULL)
+        munmap(historyMap, historyMapSize);
+    historyMapSize = fileStruct.st_size;
+    historyMap = (char*) mmap(NULL, historyMapSize, PROT_READ, MAP_SHARED, historyFD, 0);
+    if (historyMap == MAP_FAILED)
+    {
+        historyMap = NULL;
+        historyMapSize = 0;
+        return;
+    }
+    
+    const char* end = historyMap + historyMapSize;
+    const char* position = historyMap + historyIndexedSize;
+    const char* newline;
+    while ((newline = (const char*) memchr(position, '\n', end - position)) != NULL)
+    {
+        historyOffsets.push_back(position - historyMap);
+        position = newline + 1;
+    }
+    historyIndexedSize = position - historyMap;
+    return;
+}
+
+//brings historyPrefixOrder up to date with historyOffsets
+//it is only needed by history -p, so it is left alone until then, and after that only new entries have to be sorted in
+void Shell::sortHistoryPrefixes()
+{
+    indexHistory();
+    size_t firstNew = historyPrefixOrder.size();
+    if (firstNew == historyOffsets.size())
+        return;
+    
+    //sort just the new entries, then merge them in with the ones already sorted
+    for (size_t i = firstNew; i < historyOffsets.size(); i++)
+        historyPrefixOrder.push_back(i);
+    std::vector<size_t>::iterator middle = historyPrefixOrder.begin() + firstNew;
+    auto commandLess = [this](size_t a, size_t b)
+    {
+        size_t lengthA, lengthB;
+        const char* commandA = historyCommand(a, lengthA);
+        const char* commandB = historyCommand(b, lengthB);
+        int result = memcmp(commandA, commandB, std::min(lengthA, lengthB));
+        return result < 0 || (result == 0 && lengthA < lengthB);
+    };
+    std::stable_sort(middle, historyPrefixOrder.end(), commandLess);
+    std::inplace_merge(historyPrefixOrder.begin(), middle, historyPrefixOrder.end(), commandLess);
+    return;
+}
+
+//returns a pointer to entry n's command in historyMap, and puts its length (without the newline) in length
+//the command is everything after the third space, so it can have spaces of its own
+//assumes n has been indexed
+const char* Shell::historyCommand(size_t n, size_t& length)
+{
+    const char* line = historyMap + historyOffsets[n];
+    const char* end = (const char*) memchr(line, '\n', historyMap + historyIndexedSize - line);
+    const char* command = line;
+    for (int field = 0; field < 3 && command != NULL; field++)
+    {
+        command = (const char*) memchr(command, ' ', end - command);
+        if (command != NULL)
+            command++;
+    }
+    //a damaged line is treated as having an empty command
+    if (command == NULL)
+        command = end;
+    length = end - command;
+    return command;
+}
+
+//reads entry n out of historyMap
+//assumes n has been indexed
+historyRecord Shell::readHistoryEntry(size_t n)
+{
+    historyRecord record;
+    const char* line = historyMap + historyOffsets[n];
+    char* field;
+    //every indexed line ends in a newline, so strtol and strtod can't run off the end of the mapping
+    record.time = strtol(line, &field, 10);
+    record.status = strtol(field, &field, 10);
+    record.duration = strtod(field, &field);
+    size_t length;
+    const char* command = historyCommand(n, length);
+    record.command.assign(command, length);
+    return record;
+}
+
+//prints entry n as "#number: date  status  duration  command", numbered from 1 the same way ! # expects
+void Shell::printHistoryEntry(size_t n)
+{
+    historyRecord record = readHistoryEntry(n);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&record.time));
+    std::cout << "#" << n + 1 << ": " << date << std::setw(5) << record.status << std::fixed << std::setprecision(3) << std::setw(10) << record.duration << "s  " << record.command << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+    return;
+}
+
+//builds tree from the command in tokenList
+//replaces aliases and strips the background operator (-), except for newname, then reads any cond and notcond guards off the front
+//and resolves what is left to the function that runs it, splitting the @ chain straight away for linux commands and transfer
+//throws TOO_FEW_ARGS if there is no command left once the guards and background operator are gone, and anything parseGuard or splitStages throws
+void Shell::parseCommandTree(commandTree& tree)
+{
+    tree.guards.clear();
+    tree.background = false;
+    tree.stagesSplit = false;
+    tree.stages.clear();
+    
+    //newname is special in that it should not substitute any aliases
+    //this allows both the entry of aliases that refer to other aliases that would otherwise get resolved out as well as the deletion of existing aliases
+    //it should also not delete the background operator (-)
+    if (tokenList[0] != "newname")
+    {
+        parseAliases();
+        
+        //a quoted - is just an argument, and an alias can leave an empty word that isn't marked as quoted, so that is checked for too
+        if (!tokenList.empty() && !tokenIsQuoted(tokenList.size() - 1) && !tokenList.back().empty() && tokenList.back().back() == '-')
+        {
+            tree.background = true;
+            if (tokenList.back() == "-")
+            {
+                tokenList.pop_back();
+                if (tokenQuoted.size() > tokenList.size())
+                    tokenQuoted.pop_back();
+            }
+            else
+                tokenList.back().pop_back();
+        }
+        if (tokenList.empty())
+            throw error(RETURNCODE::TOO_FEW_ARGS);
+    }
+    
+    //cond and notcond are part of the line's structure rather than commands, so any number of them can be chained in front of one command
+    int pos = 0;
+    while (pos < tokenList.size() && (isOperator(pos, "cond") || isOperator(pos, "notcond")))
+    {
+        tree.guards.push_back(condGuard());
+        pos += parseGuard(pos, tree.guards.back());
+    }
+    if (pos == tokenList.size())
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    //the command's words are only needed in the tree from here on, so they are moved there rather than copied
+    tree.words.assign(std::make_move_iterator(tokenList.begin() + pos), std::make_move_iterator(tokenList.end()));
+    tree.quoted.clear();
+    for (int i = pos; i < tokenList.size(); i++)
+        tree.quoted.push_back(tokenIsQuoted(i));
+    
+    //if the command does not resolve to one of the internal functions, assume it's Linux and let the OS handle it
+    //a quoted cond or notcond is in the table, but only for its help text, so it ends up as a linux command too
+    tree.builtin = findBuiltin(tree.words[0]);
+    if (tree.builtin != NULL && tree.builtin->function == NULL)
+        tree.builtin = NULL;
+    //an internal command that can be part of an @ chain runs as one whenever it has an @ [ or ] after it, even if it is the only command
+    if (tree.builtin != NULL && tree.builtin->pipeStage)
+    {
+        for (int i = 1; i < tree.words.size(); i++)
+        {
+            if (!tree.quoted[i] && (tree.words[i] == "@" || tree.words[i] == "[" || tree.words[i] == "]"))
+            {
+                tree.builtin = NULL;
+                break;
+            }
+        }
+    }
+    tree.function = (tree.builtin == NULL) ? &staticRunLinuxCommand : tree.builtin->function;
+    if (tree.function == &staticRunLinuxCommand || tree.function == &staticTransfer)
+        splitStages(tree);
+    return;
+}
+
+//runs the command in tree if all of its guards hold, leaving its exit status in exitStatus
+//a guard that doesn't hold leaves a status of 1, the same as a failed test in front of && in other shells
+//linux commands and transfer read their stages straight from the tree, internal commands still get their words in tokenList
+//the words are swapped into tokenList for the call and swapped back afterwards rather than copied, since a compiled script line runs the same tree again
+//an unquoted $? on its own is replaced by the status of the command before, eg "grep -q x f ; echo $?", and put back once the command is done
+void Shell::runCommandTree(commandTree& tree)
+{
+    statusText = std::to_string(exitStatus);
+    for (int i = 0; i < tree.guards.size(); i++)
+    {
+        if (!checkGuard(tree.guards[i]))
+        {
+            exitStatus = 1;
+            return;
+        }
+    }
+    exitStatus = 0;
+    
+    if (tree.builtin != NULL)
+    {
+        int arguments = (int) tree.words.size() - 1;
+        if (arguments < tree.builtin->minArgs)
+            throw error(RETURNCODE::TOO_FEW_ARGS);
+        if (tree.builtin->maxArgs != -1 && arguments > tree.builtin->maxArgs)
+            throw error(RETURNCODE::TOO_MANY_ARGS);
+    }
+    
+    currentTree = &tree;
+    backgroundMode = tree.background;
+    functionPointer = tree.function;
+    if (tree.function == &staticRunLinuxCommand || tree.function == &staticTransfer)
+    {
+        functionPointer(this);
+        return;
+    }
+    
+    std::vector<int> statusWords;
+    tokenList.swap(tree.words);
+    tokenQuoted.swap(tree.quoted);
+    for (int i = 0; i < tokenList.size(); i++)
+    {
+        if (!tokenQuoted[i] && tokenList[i] == "$?")
+        {
+            tokenList[i] = statusText;
+            statusWords.push_back(i);
+        }
+    }
+    
+    //calling the static function chosen with the current object, so they can call this->realFunction()
+    //the words go back into the tree whether or not the command throws
+    try
+    {
+        functionPointer(this);
+    }
+    catch (...)
+    {
+        for (int i = 0; i < statusWords.size(); i++)
+            tokenList[statusWords[i]] = "$?";
+        tokenList.swap(tree.words);
+        tokenQuoted.swap(tree.quoted);
+        throw;
+    }
+    for (int i = 0; i < statusWords.size(); i++)
+        tokenList[statusWords[i]] = "$?";
+    tokenList.swap(tree.words);
+    tokenQuoted.swap(tree.quoted);
+    return;
+}
+
+//splits tokenList into the commands joined by ; && and ||, and builds each one's tree
+//each command gets its own alias substitution, guards and background operator, so "sleep 5 - ; ls" runs sleep in the background and then ls
+//a ; at the very end is allowed and ignored
+//throws BAD_SYNTAX if a ; && or || has no command in front of it, or && or || has none after it
+void Shell::parseCommandList(commandList& list)
+{
+    std::deque<std::string> line, command;
+    std::deque<bool> lineQuoted, commandQuoted;
+    line.swap(tokenList);
+    lineQuoted.swap(tokenQuoted);
+    lineQuoted.resize(line.size(), false);
+    
+    list.commands.clear();
+    std::string connector = "";
+    for (int i = 0; i <= line.size(); i++)
+    {
+        bool end = (i == line.size());
+        if (!end && (lineQuoted[i] || (line[i] != ";" && line[i] != "&&" && line[i] != "||")))
+        {
+            command.push_back(std::move(line[i]));
+            commandQuoted.push_back(lineQuoted[i]);
+            continue;
+        }
+        
+        if (command.empty())
+        {
+            //only a trailing ; can end a line without a command after it
+            if (!end || connector != ";")
+                throw error(RETURNCODE::BAD_SYNTAX);
+            break;
+        }
+        tokenList.swap(command);
+        tokenQuoted.swap(commandQuoted);
+        list.commands.push_back(commandTree());
+        list.commands.back().connector = connector;
+        parseCommandTree(list.commands.back());
+        command.clear();
+        commandQuoted.clear();
+        if (!end)
+            connector = line[i];
+    }
+    return;
+}
+
+//runs each command of the list in turn, && only running its command if the last one to run succeeded and || only if it failed
+//a command exiting with a non-zero status isn't an error, it just leaves the status in exitStatus for the next && || or $?
+//an internal command that throws is treated the same way, with a status of 1, unless isFatalError says the error should end the whole line
+//stop ends the list where it is
+void Shell::runCommandList(commandList& list)
+{
+    commandCount++;
+    
+    for (int i = 0; i < list.commands.size() && !stopRequested; i++)
+    {
+        commandTree& tree = list.commands[i];
+        if ((tree.connector == "&&" && exitStatus != 0) || (tree.connector == "||" && exitStatus == 0))
+            continue;
+        
+        //an internal command that fails is just a command that failed: its message is printed, its status is 1 and the list carries on
+        try
+        {
+            runCommandTree(tree);
+        }
+        catch (error const &e)
+        {
+            if (isFatalError(e.errorCode))
+                throw;
+            printError(e.errorCode);
+            exitStatus = 1;
+            reset();
+        }
+    }
+    return;
+}
+
+//COMMAND FUNCTIONS
+
+void Shell::staticPrintHistory(Shell* s)
+{
+    s->printHistory();
+}
+
+//prints this session's history ring, oldest first
+//"history -s pattern" prints every entry whose command contains pattern, "history -p prefix" every entry whose command starts with prefix
+//throws TOO_FEW_ARGS if -s or -p has no pattern, TOO_MANY_ARGS if there are extra arguments, INVALID_ARG for an unknown option
+//does not throw for no history, since no history isn't an error
+void Shell::printHistory()
+{
+    if (tokenList.size() > 1 && tokenList[1] != "-s" && tokenList[1] != "-p")
+        throw error(RETURNCODE::INVALID_ARG);
+    if (tokenList.size() == 2)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    if (tokenList.size() == 1)
+    {
+        if (historyCount == 0)
+            std::cout << "No history to display\n";
+        for (size_t i = 0; i < historyCount; i++)
+            printHistorySlot(historyRing[(historyHead + i) % historyRing.size()]);
+        return;
+    }
+    
+    indexHistory();
+    
+    //the pattern is everything after the option, so it can have spaces
+    std::string pattern = tokenList[2];
+    for (int i = 3; i < tokenList.size(); i++)
+        pattern += " " + tokenList[i];
+    std::vector<size_t> matches;
+    size_t length;
+    
+    if (tokenList[1] == "-p")
+    {
+        sortHistoryPrefixes();
+        //entries starting with the prefix are all together in historyPrefixOrder, starting where the prefix itself would go
+        std::vector<size_t>::iterator it = std::lower_bound(historyPrefixOrder.begin(), historyPrefixOrder.end(), pattern, [this](size_t entry, const std::string& prefix)
+        {
+            size_t length;
+            const char* command = historyCommand(entry, length);
+            int result = memcmp(command, prefix.data(), std::min(length, prefix.size()));
+            return result < 0 || (result == 0 && length < prefix.size());
+        });
+        for ( ; it != historyPrefixOrder.end(); it++)
+        {
+            const char* command = historyCommand(*it, length);
+            if (length < pattern.size() || memcmp(command, pattern.data(), pattern.size()) != 0)
+                break;
+            matches.push_back(*it);
+        }
+        std::sort(matches.begin(), matches.end());
+    }
+    else
+    {
+        //memmem runs over the whole mapping at once, and each hit is turned back into an entry through historyOffsets
+        //a hit outside the command part of its line (eg in the timestamp) is skipped
+        const char* position = historyMap;
+        const char* end = historyMap + historyIndexedSize;
+        const char* hit;
+        while (position < end && (hit = (const char*) memmem(position, end - position, pattern.data(), pattern.size())) != NULL)
+        {
+            size_t entry = std::upper_bound(historyOffsets.begin(), historyOffsets.end(), (off_t) (hit - historyMap)) - historyOffsets.begin() - 1;
+            const char* command = historyCommand(entry, length);
+            if (hit >= command && hit + pattern.size() <= command + length)
+            {
+                matches.push_back(entry);
+                position = command + length + 1; //on to the next line
+            }
+            else
+                position = hit + 1;
+        }
+    }
+    
+    for (int i = 0; i < matches.size(); i++)
+        printHistoryEntry(matches[i]);
+    return;
+}
+
+void Shell::staticPrintAliases(Shell* s)
+{
+    s->printAliases();
+}
+
+//prints aliases, from least to most recently used
+//does not throw, since no aliases isn't an error
+void Shell::printAliases()
+{
+    if (aliasList.size() == 0)
+        std::cout << "No aliases.  Use the newname command to enter a new alias\n";
+    else
+    {
+        int i = 0;
+        for (aliasIterator current = aliasList.begin(); current != aliasList.end(); current++, i++)
+        {
+            std::cout << i << ": ";
+            //because each alias is a queue, we need a double for loop to print
+            for (int j = 0; j < current->size(); j++)
+                std::cout << current->at(j) << " ";
+            std::cout << std::endl;
+        }
+    }
+    return;
+}
+
+void Shell::staticNewnameCommand(Shell* s)
+{
+    s->newnameCommand();
+}
+
+//if there are two commands, calls deleteAlias
+//if there are more than two, calls addNewAlias
+void Shell::newnameCommand()
+{
+    if (tokenList.size() == 2)
+        deleteAlias();
+    else
+        addNewAlias();
+}
+
+void Shell::staticDeleteAlias(Shell* s)
+{
+    s->deleteAlias();
+}
+
+//searches the alias list for the key, assumed to be the second token, and removes the alias if found
+//throws NO_ALIAS if not found, including if the alias list is empty
+void Shell::deleteAlias()
+{
+    //no need to check that index 1 exists, that happens in Shell::newnameCommand()
+    std::string key = tokenList[1];
+    aliasGeneration++;
+    
+    std::unordered_map<std::string, aliasIterator>::iterator found = aliasIndex.find(key);
+    if (found == aliasIndex.end())
+        throw error(RETURNCODE::NO_ALIAS);
+    
+    //list::erase doesn't move any of the other aliases, so the rest of aliasIndex stays valid
+    removeAlias(found->second);
+    return;
+}
+
+void Shell::staticAddNewAlias(Shell* s)
+{
+    s->addNewAlias();
+}
+
+//add new key value pair to the most recently used end of aliasList
+//aliasIndex maps each key to its place in aliasList, so finding an old value to replace doesn't need a search
+//if the list is full, the least recently used alias is dropped to make room
+//throws NO_OVERRIDE if the user tries to use an internal function name as an alias name
+//throws RECURSIVE_ALIAS if any token in the alias value is the same as the key, or is an alias that expands to use the key
+void Shell::addNewAlias()
+{
+    //first check to make sure the new alias isn't a preexisting command
+    if (isReservedName(tokenList[1]))
+        throw error(RETURNCODE::NO_OVERRIDE);
+    
+    //no need to check that these values exist, that was already done in newnameCommand()
+    std::string key = tokenList[1];
+    
+    //the first element in the queue is the key and everything afterwards is the value
+    //built before anything changes, so a recursive alias doesn't leave the old one deleted
+    std::deque<std::string> newAliasPair;
+    newAliasPair.push_back(key);
+    std::set<std::string> visited;
+    for (int i = 2; i < tokenList.size(); i++)
+    {
+        //recursion check - if any value of the alias is the key, or an alias that leads back to the key, it won't be able to resolve
+        //this is the only place a cycle could be created, so checking here means expansion never has to
+        if (tokenList[i] == key || aliasReaches(tokenList[i], key, visited))
+            throw error(RETURNCODE::RECURSIVE_ALIAS);
+        newAliasPair.push_back(tokenList[i]);
+    }
+    
+    //compiled script lines redo their alias substitution once this changes
+    aliasGeneration++;
+    
+    //if the alias already exists, replace the old value, and either way it is now the most recently used
+    std::unordered_map<std::string, aliasIterator>::iterator found = aliasIndex.find(key);
+    if (found != aliasIndex.end())
+        removeAlias(found->second);
+    else
+        trimAliasList(maxAliasSize - 1); //if full, deletes the least recently used element first
+    
+    aliasList.push_back(newAliasPair);
+    aliasIndex[key] = --aliasList.end();
+    linkAlias(newAliasPair);
+    //anything that used the key as a plain word now has to expand it
+    invalidateAlias(key);
+    expandAlias(key);
+    return;
+}
+
+//cond and notcond are never run from the builtin table since they are handled by parseCommandTree, but an alias can't take their names either
+bool Shell::isReservedName(std::string name)
+{
+    return findBuiltin(name) != NULL;
+}
+
+//true if token is an alias whose expansion would need target, following the dependency graph depth first
+//visited holds the aliases already searched, so each is only looked at once per addNewAlias
+bool Shell::aliasReaches(std::string token, std::string target, std::set<std::string>& visited)
+{
+    std::unordered_map<std::string, aliasIterator>::iterator found = aliasIndex.find(token);
+    if (found == aliasIndex.end() || !visited.insert(token).second)
+        return false;
+    
+    const std::deque<std::string>& alias = *found->second;
+    for (int i = 1; i < alias.size(); i++)
+    {
+        if (alias[i] == target || aliasReaches(alias[i], target, visited))
+            return true;
+    }
+    return false;
+}
+
+//adds an edge from each token of the alias's value back to the alias, so invalidateAlias can find it
+void Shell::linkAlias(const std::deque<std::string>& alias)
+{
+    for (int i = 1; i < alias.size(); i++)
+        aliasDependents[alias[i]].insert(alias[0]);
+    return;
+}
+
+//forgets the expansion of key, and of every alias that depends on it directly or indirectly
+//key doesn't need to be an alias, since a plain word can become one
+void Shell::invalidateAlias(std::string key)
+{
+    std::deque<std::string> pending(1, key);
+    std::set<std::string> visited;
+    while (!pending.empty())
+    {
+        std::string current = pending.front();
+        pending.pop_front();
+        if (!visited.insert(current).second)
+            continue;
+        aliasExpansions.erase(current);
+        
+        std::unordered_map<std::string, std::set<std::string>>::iterator dependents = aliasDependents.find(current);
+        if (dependents != aliasDependents.end())
+            pending.insert(pending.end(), dependents->second.begin(), dependents->second.end());
+    }
+    return;
+}
+
+//takes an alias out of the list, the index and the dependency graph, and forgets every expansion that went through it
+void Shell::removeAlias(aliasIterator alias)
+{
+    std::string key = alias->at(0);
+    invalidateAlias(key);
+    for (int i = 1; i < alias->size(); i++)
+    {
+        std::unordered_map<std::string, std::set<std::string>>::iterator dependents = aliasDependents.find(alias->at(i));
+        if (dependents == aliasDependents.end())
+            continue;
+        dependents->second.erase(key);
+        if (dependents->second.empty())
+            aliasDependents.erase(dependents);
+    }
+    aliasIndex.erase(key);
+    aliasList.erase(alias);
+    return;
+}
+
+//moves an alias to the end of aliasList, so it is the last to be dropped when the list is full
+//splice only relinks the node, so the iterator in aliasIndex stays valid
+void Shell::useAlias(aliasIterator alias)
+{
+    aliasList.splice(aliasList.end(), aliasList, alias);
+    return;
+}
+
+//drops aliases from the front (least recently used) of aliasList until there are at most size left
+void Shell::trimAliasList(int size)
+{
+    while (aliasList.size() > 0 && (int) aliasList.size() > size)
+    {
+        removeAlias(aliasList.begin());
+        aliasGeneration++;
+    }
+    return;
+}
+
+void Shell::staticSaveNewAliasFile(Shell* s)
+{
+    s->saveNewAliasFile();
+}
+
+//saves the alias list to the file name specified in tokenList[1], creates it if it doesn't exist
+//with -b first, writes a binary snapshot instead: a header (magic, version, alias count, checksum of the rest), then each alias as
+//its token count followed by every token as a length and its bytes, all 32 bit and in this machine's byte order
+//throws TOO_FEW_ARGS or TOO_MANY_ARGS if there aren't exactly two tokens (three with -b)
+//throws FILE_ERROR if for some reason it isn't able to open the file fro writing
+void Shell::saveNewAliasFile()
+{
+    bool binary = (tokenList.size() > 1 && tokenList[1] == "-b");
+    int expected = binary ? 3 : 2;
+    if (tokenList.size() < expected)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    if (tokenList.size() > expected)
+        throw error(RETURNCODE::TOO_MANY_ARGS);
+    
+    //opening in trunc mode to overwrite anything there previously
+    std::ofstream aliasFile(tokenList.back(), binary ? (std::ios::trunc | std::ios::binary) : std::ios::trunc);
+    if (!aliasFile)
+        throw error(RETURNCODE::FILE_ERROR);
+    
+    if (binary)
+    {
+        std::string payload;
+        for (aliasIterator current = aliasList.begin(); current != aliasList.end(); current++)
+        {
+            appendUint32(payload, current->size());
+            for (int j = 0; j < current->size(); j++)
+            {
+                appendUint32(payload, current->at(j).size());
+                payload.append(current->at(j));
+            }
+        }
+        std::string header(ALIAS_SNAPSHOT_MAGIC, sizeof(ALIAS_SNAPSHOT_MAGIC));
+        appendUint32(header, ALIAS_SNAPSHOT_VERSION);
+        appendUint32(header, aliasList.size());
+        appendUint32(header, fnv1aChecksum(payload.data(), payload.size()));
+        aliasFile << header << payload;
+    }
+    else
+    {
+        //'\n' rather than endl, so the file is only flushed once at the end instead of after every alias
+        for (aliasIterator current = aliasList.begin(); current != aliasList.end(); current++)
+        {
+            for (int j = 0; j < current->size(); j++)
+            {
+                aliasFile << current->at(j) << " ";
+            }
+            aliasFile << '\n';
+        }
+    }
+    
+    aliasFile.close();
+    if (!aliasFile)
+        throw error(RETURNCODE::FILE_ERROR);
+    return;
+}
+
+void Shell::staticReadAliasFile(Shell* s)
+{
+    s->readAliasFile();
+}
+
+//reads all aliases from the file specified in tokenList[1]
+//the file is mapped into memory and tokenized in one pass, then commitAliases checks and adds the whole set at once,
+//so a bad line leaves the alias list exactly as it was
+//throws FILE_ERROR if the file does not exist or cannot be opened
+//throws BAD_FORMAT if any line of the file does not have at least two tokens (key + value), plus anything commitAliases throws
+void Shell::readAliasFile()
+{
+    std::string fileName = tokenList[1];
+    int file = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file == -1)
+        throw error(RETURNCODE::FILE_ERROR);
+    struct stat fileStruct;
+    if (fstat(file, &fileStruct) == -1)
+    {
+        close(file);
+        throw error(RETURNCODE::FILE_ERROR);
+    }
+    //mmap refuses a length of 0, and an empty file has no aliases anyway
+    if (fileStruct.st_size == 0)
+    {
+        close(file);
+        return;
+    }
+    
+    void* mapped = mmap(NULL, fileStruct.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); //the mapping keeps its own reference to the file
+    if (mapped == MAP_FAILED)
+        throw error(RETURNCODE::FILE_ERROR);
+    madvise(mapped, fileStruct.st_size, MADV_SEQUENTIAL);
+    
+    const char* data = (const char*) mapped;
+    const char* end = data + fileStruct.st_size;
+    std::vector<std::deque<std::string>> aliases;
+    std::vector<int> lineNumbers;
+    int lineNumber = 0;
+    
+    //binary snapshots are read straight out of the mapping, with each alias numbered in place of a line
+    if (fileStruct.st_size >= sizeof(ALIAS_SNAPSHOT_MAGIC) && memcmp(data, ALIAS_SNAPSHOT_MAGIC, sizeof(ALIAS_SNAPSHOT_MAGIC)) == 0)
+    {
+        bool valid = parseAliasSnapshot(data, fileStruct.st_size, aliases);
+        munmap(mapped, fileStruct.st_size);
+        if (!valid)
+            throw error(RETURNCODE::BAD_FORMAT);
+        for (int i = 0; i < aliases.size(); i++)
+            lineNumbers.push_back(i + 1);
+        commitAliases(aliases, lineNumbers, fileName);
+        return;
+    }
+    
+    //otherwise one pass over the file, splitting it into lines and each line into tokens on the same whitespace istringstream would use
+    for (const char* position = data; position < end; )
+    {
+        lineNumber++;
+        std::deque<std::string> alias;
+        while (position < end && *position != '\n')
+        {
+            if (isspace((unsigned char) *position))
+            {
+                position++;
+                continue;
+            }
+            const char* tokenStart = position;
+            while (position < end && !isspace((unsigned char) *position))
+                position++;
+            alias.push_back(std::string(tokenStart, position));
+        }
+        position++; //past the newline
+        aliases.push_back(alias);
+        lineNumbers.push_back(lineNumber);
+    }
+    munmap(mapped, fileStruct.st_size);
+    
+    commitAliases(aliases, lineNumbers, fileName);
+    return;
+}
+
+//reads the aliases out of a binary snapshot written by savenewnames -b, checking the version, the checksum, and that every length fits
+//returns false if anything is wrong, in which case aliases may be partly filled
+bool Shell::parseAliasSnapshot(const char* data, size_t size, std::vector<std::deque<std::string>>& aliases)
+{
+    uint32_t version, count, checksum;
+    size_t headerSize = sizeof(ALIAS_SNAPSHOT_MAGIC) + 3 * sizeof(uint32_t);
+    if (size < headerSize)
+        return false;
+    //memcpy rather than casting the pointer, since nothing in the file is aligned
+    memcpy(&version, data + 4, sizeof(uint32_t));
+    memcpy(&count, data + 8, sizeof(uint32_t));
+    memcpy(&checksum, data + 12, sizeof(uint32_t));
+    if (version != ALIAS_SNAPSHOT_VERSION || fnv1aChecksum(data + headerSize, size - headerSize) != checksum)
+        return false;
+    
+    size_t position = headerSize;
+    uint32_t length;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t tokenCount;
+        if (size - position < sizeof(uint32_t))
+            return false;
+        memcpy(&tokenCount, data + position, sizeof(uint32_t));
+        position += sizeof(uint32_t);
+        
+        aliases.push_back(std::deque<std::string>());
+        for (uint32_t j = 0; j < tokenCount; j++)
+        {
+            if (size - position < sizeof(uint32_t))
+                return false;
+            memcpy(&length, data + position, sizeof(uint32_t));
+            position += sizeof(uint32_t);
+            if (size - position < length)
+                return false;
+            aliases.back().push_back(std::string(data + position, length));
+            position += length;
+        }
+    }
+    return position == size;
+}
+
+//checks a whole set of aliases, in the order they should be added, then adds them all
+//later entries with the same key replace earlier ones, the same as calling addNewAlias on each in turn would
+//if anything is wrong, the file name and line number of the bad entry are printed and nothing is added
+//throws BAD_FORMAT if an entry doesn't have a key and at least one value, NO_OVERRIDE if a key is an internal command
+//throws RECURSIVE_ALIAS if the new set, together with the current aliases, has a cycle
+void Shell::commitAliases(const std::vector<std::deque<std::string>>& aliases, const std::vector<int>& lineNumbers, std::string fileName)
+{
+    //the alias set once everything is added, with the index of the entry each key finally comes from (-1 for current aliases)
+    std::unordered_map<std::string, std::pair<const std::deque<std::string>*, int>> merged;
+    for (aliasIterator current = aliasList.begin(); current != aliasList.end(); current++)
+        merged[current->at(0)] = std::make_pair(&*current, -1);
+    
+    for (int i = 0; i < aliases.size(); i++)
+    {
+        if (aliases[i].size() < 2)
+        {
+            std::cout << fileName << ":" << lineNumbers[i] << ": ";
+            throw error(RETURNCODE::BAD_FORMAT);
+        }
+        if (isReservedName(aliases[i][0]))
+        {
+            std::cout << fileName << ":" << lineNumbers[i] << ": ";
+            throw error(RETURNCODE::NO_OVERRIDE);
+        }
+        merged[aliases[i][0]] = std::make_pair(&aliases[i], i);
+    }
+    
+    //depth first search over the merged set, looking for an alias that is reached again while it is still being expanded
+    //0 = not visited, 1 = being expanded, 2 = done, so every alias is only searched once
+    std::unordered_map<std::string, int> state;
+    for (std::unordered_map<std::string, std::pair<const std::deque<std::string>*, int>>::iterator root = merged.begin(); root != merged.end(); root++)
+    {
+        if (state[root->first] != 0)
+            continue;
+        
+        //each frame is an alias and the index of the next token of its value to look at
+        std::vector<std::pair<std::string, int>> stack(1, std::make_pair(root->first, 1));
+        state[root->first] = 1;
+        while (!stack.empty())
+        {
+            const std::deque<std::string>& alias = *merged[stack.back().first].first;
+            if (stack.back().second == alias.size())
+            {
+                state[stack.back().first] = 2;
+                stack.pop_back();
+                continue;
+            }
+            std::string token = alias[stack.back().second++];
+            if (merged.count(token) == 0 || state[token] == 2)
+                continue;
+            if (state[token] == 1)
+            {
+                //report the line of one of the new aliases in the cycle
+                for (int i = (int) stack.size() - 1; i >= 0; i--)
+                {
+                    int entry = merged[stack[i].first].second;
+                    if (entry != -1)
+                    {
+                        std::cout << fileName << ":" << lineNumbers[entry] << ": ";
+                        break;
+                    }
+                }
+                throw error(RETURNCODE::RECURSIVE_ALIAS);
+            }
+            state[token] = 1;
+            stack.push_back(std::make_pair(token, 1));
+        }
+    }
+    
+    //everything is valid, so add each new alias where addNewAlias would have put it
+    aliasGeneration++;
+    for (int i = 0; i < aliases.size(); i++)
+    {
+        if (merged[aliases[i][0]].second != i)
+            continue; //replaced by a later line
+        std::unordered_map<std::string, aliasIterator>::iterator found = aliasIndex.find(aliases[i][0]);
+        if (found != aliasIndex.end())
+            removeAlias(found->second);
+        aliasList.push_back(aliases[i]);
+        aliasIndex[aliases[i][0]] = --aliasList.end();
+        linkAlias(aliases[i]);
+        invalidateAlias(aliases[i][0]);
+    }
+    //only trimmed once everything is in, dropping the least recently used if the set is bigger than maxAliasSize
+    trimAliasList(maxAliasSize);
+    return;
+}
+
+//argv points straight into the stage's words, which stay alive until the exec, and statusText for any $?
+//eg "ls -l" becomes "ls", "-l", NULL
+void Shell::buildArgv(const commandStage& stage, std::vector<char*>& argv)
+{
+    for (int i = 0; i < stage.words.size(); i++)
+        argv.push_back(const_cast<char*>(stage.words[i].c_str()));
+    for (int i = 0; i < stage.statusWords.size(); i++)
+        argv[stage.statusWords[i]] = const_cast<char*>(statusText.c_str());
+    argv.push_back(NULL);
+    return;
+}
+
+//execs the command in stage, using the full path already resolved by the parent
+//an empty path means the parent couldn't find it in $PATH
+//if the exec fails with ENOENT, the hashed path is stale, so the child exits with 127 to tell the parent to forget it
+void Shell::runChildProcess(const commandStage& stage, std::string fullFileName)
+{
+    //the transfer stage has no program to exec, this forked copy of the shell does the work itself
+    if (stage.words[0] == "transfer")
+    {
+        if (transferData(STDIN_FILENO, STDOUT_FILENO))
+            std::exit(0);
+        perror("transfer");
+        std::exit(1);
+    }
+    
+    //127 and 126 are what other shells use for a command that couldn't be found or couldn't be run, so && || and $? see the failure
+    if (fullFileName == "")
+    {
+        std::cerr << "Command not found\n";
+        std::exit(127);
+    }
+    
+    std::vector<char*> argv;
+    buildArgv(stage, argv);
+    execve(fullFileName.c_str(), argv.data(), environ);
+    
+    //if execve failed, exit
+    if (errno == ENOENT)
+    {
+        std::cerr << "Command not found\n";
+        std::exit(127);
+    }
+    perror(stage.words[0].c_str());
+    std::exit(126);
+    return;
+}
+
+//starts the command in stage with inFD as its stdin and outFD as its stdout (-1 leaves the shell's own)
+//every pipe and redirection file is opened with O_CLOEXEC, so the child only keeps the two it is given
+//uses posix_spawn when spawnMode is set, since fork has to copy the page tables of the whole shell
+//falls back to fork if the command wasn't found (the child prints the error) or if posix_spawn itself fails
+//transfer stages have no path, so they always take the fork route and run in the child without an exec
+//with job control the child goes into process group pgid, or a new group of its own if pgid is 0, and the first command of a foreground job takes the terminal
+//-1 leaves it in the shell's group.  Either way the signals the shell ignores are put back to the default, except that in the shell's group ctrl-z stays ignored,
+//since the shell couldn't do anything with a stopped command there
+//the parent sets the group as well, so it is right whichever of the two gets there first
+pid_t Shell::launchChild(const commandStage& stage, std::string fullFileName, int inFD, int outFD, pid_t pgid)
+{
+    bool takeTerminal = jobControl && pgid == 0 && !backgroundMode;
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    if (pgid != -1)
+    {
+        sigaddset(&defaults, SIGTSTP);
+        sigaddset(&defaults, SIGTTIN);
+        sigaddset(&defaults, SIGTTOU);
+    }
+    
+    pid_t child;
+    if (spawnMode && fullFileName != "")
+    {
+        posix_spawn_file_actions_t fileActions;
+        posix_spawn_file_actions_init(&fileActions);
+        if (inFD != -1)
+            posix_spawn_file_actions_adddup2(&fileActions, inFD, STDIN_FILENO);
+        if (outFD != -1)
+            posix_spawn_file_actions_adddup2(&fileActions, outFD, STDOUT_FILENO);
+        
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        if (jobControl)
+        {
+            short flags = POSIX_SPAWN_SETSIGDEF;
+            posix_spawnattr_setsigdefault(&attributes, &defaults);
+            if (pgid != -1)
+            {
+                flags |= POSIX_SPAWN_SETPGROUP;
+                posix_spawnattr_setpgroup(&attributes, pgid);
+            }
+            posix_spawnattr_setflags(&attributes, flags);
+            //glibc 2.35 can hand the child the terminal before the exec, otherwise waitForJob does it a moment later
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 35)
+            if (takeTerminal)
+                posix_spawn_file_actions_addtcsetpgrp_np(&fileActions, STDIN_FILENO);
+#endif
+#endif
+        }
+        
+        std::vector<char*> argv;
+        buildArgv(stage, argv);
+        
+        int spawnError = posix_spawn(&child, fullFileName.c_str(), &fileActions, &attributes, argv.data(), environ);
+        //the path can still disappear between the lookup and the spawn, so a hashed name gets one fresh search of $PATH before it fails
+        if (spawnError == ENOENT && stage.words[0].find('/') == std::string::npos)
+        {
+            commandHashTable.erase(stage.words[0]);
+            fullFileName = findCommandPath(stage.words[0]);
+            if (fullFileName != "")
+                spawnError = posix_spawn(&child, fullFileName.c_str(), &fileActions, &attributes, argv.data(), environ);
+        }
+        posix_spawn_file_actions_destroy(&fileActions);
+        posix_spawnattr_destroy(&attributes);
+        
+        if (spawnError == 0)
+        {
+            if (jobControl && pgid != -1)
+                setpgid(child, (pgid == 0) ? child : pgid);
+            return child;
+        }
+        //a stale hash entry gets the same treatment as a failed exec in runChildProcess
+        if (spawnError == ENOENT)
+            commandHashTable.erase(stage.words[0]);
+    }
+    
+    child = fork();
+    if (child == 0)
+    {
+        if (jobControl)
+        {
+            if (pgid != -1)
+                setpgid(0, pgid);
+            if (takeTerminal)
+                tcsetpgrp(STDIN_FILENO, getpgrp());
+            for (int sig = 1; sig < NSIG; sig++)
+                if (sigismember(&defaults, sig) == 1)
+                    signal(sig, SIG_DFL);
+        }
+        if (inFD != -1)
+            dup2(inFD, STDIN_FILENO);
+        if (outFD != -1)
+            dup2(outFD, STDOUT_FILENO);
+        runChildProcess(stage, fullFileName);
+    }
+    if (child > 0 && jobControl && pgid != -1)
+        setpgid(child, (pgid == 0) ? child : pgid);
+    return child;
+}
+
+void Shell::staticRunLinuxCommand(Shell* s)
+{
+    s->runLinuxCommand();
+}
+
+//starts every stage of tree, connected by pipes and with their redirection, and returns their pids without waiting
+//if captureFD isn't -1 it becomes stdout for the last command, unless that command has its own ] file
+//launchClock is set to the time just before the first command started
+//with job control the commands get a process group of their own, which is returned in pgid (0 if there isn't one)
+//parallel's commands (the ones with a captureFD) stay in the shell's group, so ctrl-c still reaches them
+//the stages are split here if parseCommandTree didn't already, eg for man passing an unknown page on to linux
+std::vector<pid_t> Shell::launchPipeline(commandTree& tree, int captureFD, struct timespec& launchClock, pid_t& pgid)
+{
+    //anything the shell has printed has to come out before the commands' own output, and fork would copy it into the child too
+    //batch mode doesn't flush after each line, so this is where its output actually gets written
+    std::cout.flush();
+    if (tree.words.empty())
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    if (!tree.stagesSplit)
+        splitStages(tree);
+    openRedirectionFiles(tree); //first check for redirection or piping
+    
+    //every stage is resolved here in the parent, so that the hash table actually gets filled
+    //doing it in the child would throw the result away on every command
+    //transfer stages and internal commands are run by the shell itself, so they have nothing to look up
+    //internal commands get the same argument check as when they run on their own, before anything has started
+    std::vector<std::string> commandPaths;
+    for (int i = 0; i < tree.stages.size(); i++)
+    {
+        const commandStage& stage = tree.stages[i];
+        if (stage.words[0] == "transfer")
+        {
+            if (stage.words.size() > 1)
+                throw error(RETURNCODE::TOO_MANY_ARGS);
+            commandPaths.push_back("");
+        }
+        else if (stage.builtin != NULL)
+        {
+            //internal commands never read their stdin, so a [ file for one is a mistake rather than something to quietly drop
+            if (stage.inputFile != "")
+                throw error(RETURNCODE::BAD_SYNTAX);
+            int arguments = (int) stage.words.size() - 1;
+            if (arguments < stage.builtin->minArgs)
+                throw error(RETURNCODE::TOO_FEW_ARGS);
+            if (stage.builtin->maxArgs != -1 && arguments > stage.builtin->maxArgs)
+                throw error(RETURNCODE::TOO_MANY_ARGS);
+            commandPaths.push_back("");
+        }
+        else
+            commandPaths.push_back(findCommandPath(tree.stages[i].words[0]));
+    }
+    
+    //backjobs and jobstats report finished jobs first, which has to happen here on the main thread,
+    //since on the helper thread the notices would go down the chain and bgJobQueue would change under the shell
+    for (int i = 0; i < tree.stages.size(); i++)
+    {
+        if (tree.stages[i].builtin != NULL)
+        {
+            reapChildren();
+            std::cout.flush();
+            break;
+        }
+    }
+    
+    pid_t child;
+    std::vector<pid_t> childList;
+    int stageCount = (int) tree.stages.size();
+    pgid = (jobControl && captureFD == -1) ? 0 : -1;
+    clock_gettime(CLOCK_MONOTONIC, &launchClock);
+    
+    //all of the pipes are created up front in one flat array, pipe i is pipeFDs[2i] (read end) and pipeFDs[2i + 1] (write end)
+    //stage i reads from pipe i - 1 and writes to pipe i, unless it has its own [ or ] file
+    //O_CLOEXEC means no child inherits any pipe end except the ones duplicated onto its stdin and stdout
+    std::vector<int> pipeFDs(2 * (stageCount - 1));
+    for (int i = 0; i < stageCount - 1; i++)
+    {
+        if (pipe2(&pipeFDs[2 * i], O_CLOEXEC) == -1)
+        {
+            for (int j = 0; j < 2 * i; j++)
+                close(pipeFDs[j]);
+            throw error(RETURNCODE::PROCESS_ERROR);
+        }
+    }
+    
+    for (int i = 0; i < stageCount; i++)
+    {
+        int inFD = stageInputFDs[i];
+        if (inFD == -1 && i > 0)
+            inFD = pipeFDs[2 * (i - 1)];
+        int outFD = stageOutputFDs[i];
+        if (outFD == -1 && i < stageCount - 1)
+            outFD = pipeFDs[2 * i + 1];
+        else if (outFD == -1)
+            outFD = captureFD;
+        
+        //an internal command gets its own copy of its stdout for the helper thread, and 0 in place of a pid
+        //it never reads its stdin (a [ file for one was rejected above), so the pipe into it is just closed below, the same as a linux command that exits without reading
+        const commandStage& stage = tree.stages[i];
+        if (stage.builtin != NULL)
+        {
+            builtinStage internal;
+            internal.index = i;
+            internal.builtin = stage.builtin;
+            internal.words = stage.words;
+            for (int j = 0; j < stage.statusWords.size(); j++)
+                internal.words[stage.statusWords[j]] = statusText;
+            internal.outFD = fcntl((outFD == -1) ? STDOUT_FILENO : outFD, F_DUPFD_CLOEXEC, 0);
+            internal.status = 0;
+            internal.usage = {};
+            builtinStages.push_back(internal);
+            childList.push_back(0);
+        }
+        else
+        {
+            child = launchChild(stage, commandPaths[i], inFD, outFD, pgid);
+            childList.push_back(child);
+            if (pgid == 0 && child > 0)
+                pgid = child;
+        }
+        
+        //the shell never uses the pipes itself, so each end is closed as soon as the stage that needs it has been started
+        //this way the readers see EOF as soon as their writer finishes
+        if (i > 0)
+            close(pipeFDs[2 * (i - 1)]);
+        if (i < stageCount - 1)
+            close(pipeFDs[2 * i + 1]);
+    }
+    
+    //the children have their own copies of the redirection files now
+    closeRedirectionFiles();
+    if (pgid == -1)
+        pgid = 0;
+    
+    //the helper thread blocks SIGPIPE, so an internal command writing to a chain that has stopped reading gets EPIPE rather than killing the shell
+    //SIGCHLD is blocked as well so it is always the main thread that gets interrupted
+    if (!builtinStages.empty())
+    {
+        sigset_t blocked, previous;
+        sigemptyset(&blocked);
+        sigaddset(&blocked, SIGPIPE);
+        sigaddset(&blocked, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+        stageWorker = std::thread(&Shell::runBuiltinStages, this);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    }
+    return childList;
+}
+
+//runs on stageWorker, taking each internal command launchPipeline set up in turn, with std::cout pointed at its copy of its stdout
+//the shell doesn't touch anything until finishBuiltinStages has joined this thread, so the commands can use tokenList and the rest as usual
+//tokenList and exitStatus are put back afterwards, since the command that started the chain is still running
+void Shell::runBuiltinStages()
+{
+    std::deque<std::string> savedTokens;
+    std::deque<bool> savedQuoted;
+    savedTokens.swap(tokenList);
+    savedQuoted.swap(tokenQuoted);
+    int savedStatus = exitStatus;
+    runningAsStage = true;
+    std::streambuf* shellOutput = std::cout.rdbuf();
+    struct rusage before = {}, after;
+    
+    for (std::vector<builtinStage>::iterator it = builtinStages.begin(); it != builtinStages.end(); it++)
+    {
+        {
+            fdStreamBuffer output(it->outFD);
+            std::cout.rdbuf(&output);
+            tokenList = it->words;
+            tokenQuoted.assign(tokenList.size(), false);
+            exitStatus = 0;
+            try
+            {
+                it->builtin->function(this);
+                it->status = exitStatus;
+            }
+            catch (error const &e)
+            {
+                it->failure = std::current_exception();
+                it->status = 1;
+            }
+            std::cout.flush();
+            std::cout.rdbuf(shellOutput);
+            std::cout.clear();
+        }
+        close(it->outFD);
+        
+        //RUSAGE_THREAD counts from when the thread started, so each command gets the difference from the one before
+        getrusage(RUSAGE_THREAD, &after);
+        it->usage = after;
+        timersub(&after.ru_utime, &before.ru_utime, &it->usage.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &it->usage.ru_stime);
+        before = after;
+    }
+    
+    tokenList.swap(savedTokens);
+    tokenQuoted.swap(savedQuoted);
+    exitStatus = savedStatus;
+    runningAsStage = false;
+    return;
+}
+
+//waits for stageWorker to finish and records how each of its commands ended in job, which is what launchPipeline's pids went into
+//returns the first error one of them threw, so the caller can pass it on once it is done with the rest of the chain
+std::exception_ptr Shell::finishBuiltinStages(bgJob& job)
+{
+    std::exception_ptr failure;
+    if (!stageWorker.joinable())
+        return failure;
+    stageWorker.join();
+    for (std::vector<builtinStage>::iterator it = builtinStages.begin(); it != builtinStages.end(); it++)
+    {
+        recordProcessEnd(job, it->index, W_EXITCODE(it->status, 0), it->usage);
+        if (it->failure && !failure)
+            failure = it->failure;
+    }
+    builtinStages.clear();
+    return failure;
+}
+
+//passes the command in currentTree to the OS
+void Shell::runLinuxCommand()
+{
+    commandTree& tree = *currentTree;
+    
+    //a utility on its own in the foreground doesn't need a process at all
+    if (utilityMode && !backgroundMode)
+    {
+        if (!tree.stagesSplit)
+            splitStages(tree);
+        if (tree.stages.size() == 1 && tree.stages[0].utility != -1 && runUtility(tree))
+            return;
+    }
+    
+    struct timespec launchClock;
+    pid_t pgid;
+    std::vector<pid_t> childList = launchPipeline(tree, -1, launchClock, pgid);
+    std::exception_ptr failure;
+    
+    //internal commands in the chain are always finished before the shell moves on, even for a background job
+    //their output goes to the rest of the chain, which is already running, so this only waits as long as they take to print
+    if (backgroundMode)
+    {
+        addJobToBGQueue(tree, childList, launchClock, pgid);
+        failure = finishBuiltinStages(bgJobQueue.find(bgJobCount)->second);
+    }
+    else
+    {
+        //every command is waited for, even once one has failed, so none of them are left as zombies
+        //wait4 rather than waitpid so the resource usage of each command ends up in jobstats
+        //children are collected in whatever order they finish, so each one's end time is when it actually exited
+        //background processes that finish in the meantime are left for reapChildren to report before the next prompt
+        bgJob job = createJob(0, tree, childList, launchClock, pgid);
+        failure = finishBuiltinStages(job);
+        if (waitForJob(job, false))
+        {
+            //stopped with ctrl-z, so it carries on as a background job, and the status is 128 plus the signal like in other shells
+            addStoppedJob(job);
+            exitStatus = 128 + SIGTSTP;
+        }
+        else
+        {
+            //127 means the remembered path for a stage no longer exists, so it gets looked up again next time
+            for (int i = 0; i < job.processList.size() && i < tree.stages.size(); i++)
+            {
+                int status = job.processList[i].status;
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+                    commandHashTable.erase(tree.stages[i].words[0]);
+            }
+            addJobToStats(job);
+            exitStatus = jobExitStatus(job);
+        }
+    }
+    
+    //an error from an internal command is reported like any other, once the rest of the chain is taken care of
+    if (failure)
+        std::rethrow_exception(failure);
+    return;
+}
+
+//runs the single stage of tree with its utility from utilityTable, inside the shell rather than in a new process
+//[ and ] work as usual, the utility just reads and writes those files instead of stdin and stdout
+//returns false without running anything if the utility can't handle these arguments, so the real program runs instead
+bool Shell::runUtility(commandTree& tree)
+{
+    const commandStage& stage = tree.stages[0];
+    std::deque<std::string> args = stage.words;
+    for (int i = 0; i < stage.statusWords.size(); i++)
+        args[stage.statusWords[i]] = statusText;
+    
+    openRedirectionFiles(tree);
+    int inFD = (stageInputFDs[0] != -1) ? stageInputFDs[0] : STDIN_FILENO;
+    int outFD = (stageOutputFDs[0] != -1) ? stageOutputFDs[0] : STDOUT_FILENO;
+    
+    //anything the shell printed before has to come out first, since the utility writes straight to the fd
+    std::cout.flush();
+    int status = utilityTable[stage.utility].function(this, args, inFD, outFD);
+    closeRedirectionFiles();
+    if (status == -1)
+        return false;
+    exitStatus = status;
+    return true;
+}
+
+//I didn't actually implement this yet, partly because it wouldn't have been used anyway since we were given a script to run
+//and also because I thought this might make a decent contender for the "add a new function" portion of assignment 2
+//the intention is for the "man" command to print usage info for all internal functions
+//if the argument isn't an internal function, it passes it onto the OS as usual
+
+void Shell::staticInfoCommand(Shell* s)
+{
+    s->infoCommand();
+}
+
+//print usage info for the given command
+//if it's not one of my commands, pass it on to linux
+void Shell::infoCommand()
+{
+    //if the second command is in the builtin table and has help text, then it prints that
+    //otherwise it runs a regular linux command and lets the real man function handle it
+    const builtinCommand* builtin = findBuiltin(tokenList[1]);
+    if (builtin != NULL && builtin->info != NULL)
+    {
+        std::cout << "======================================\n";
+        std::cout << *builtin->info;
+        std::cout << "======================================\n";
+    }
+    else
+    {
+        //the words of this command's tree are in tokenList while it runs (see runCommandTree), so the real man gets a tree of its own built from them
+        commandTree manTree;
+        manTree.words = tokenList;
+        manTree.quoted = tokenQuoted;
+        manTree.quoted.resize(manTree.words.size(), false);
+        manTree.background = backgroundMode;
+        manTree.function = &staticRunLinuxCommand;
+        commandTree* savedTree = currentTree;
+        currentTree = &manTree;
+        try
+        {
+            runLinuxCommand();
+        }
+        catch (...)
+        {
+            currentTree = savedTree;
+            throw;
+        }
+        currentTree = savedTree;
+    }
+    return;
+}
+
+//runs currentCompiled the same way run() would run the line, but from its compiled form
+//the command trees are only built the first time the line runs, or again if the aliases have changed since
+void Shell::runCompiledLine()
+{
+    compiledLine& line = *currentCompiled;
+    currentLine = line.text;
+    
+    if (line.aliasGeneration != aliasGeneration)
+    {
+        tokenList = line.tokens;
+        tokenQuoted = line.quoted;
+        //marked stale until it is built, so a line that fails to parse is tried again next time
+        line.aliasGeneration = -1;
+        parseCommandList(line.list);
+        line.aliasGeneration = aliasGeneration;
+    }
+    
+    runCommandList(line.list);
+    return;
+}
+
+//main driver
+//calls the other functions in order
+//a command that exits with a non-zero status is not an error, only internal commands that fail and real faults throw back to main
+//returns false once stop has run, so main can exit
+bool Shell::run()
+{
+    try
+    {
+        //while command line is empty, print name, counter, delim
+        //then read command line
+        reapChildren();
+        printCommandLine();
+        while (!readCommandLine())
+        {
+            if (stopRequested)
+                return false;
+            reapChildren();
+            printCommandLine();
+        }
+        
+        if (!NOHISTORYFLAG)
+            addCommandToHistory();
+        
+        //lines from the script cache skip straight to running
+        if (currentCompiled != NULL)
+        {
+            runCompiledLine();
+            finishHistoryEntry(exitStatus);
+            return !stopRequested;
+        }
+        
+        //tokenize
+        parseCommandLine();
+        
+        //determine command and run it
+        //output goes through here like every other command, so its $? is filled in and a ; && or || after it still splits the line
+        parseCommandList(lineList);
+        runCommandList(lineList);
+        finishHistoryEntry(exitStatus);
+    }
+    catch (error const &e)
+    {
+        exitStatus = 1;
+        finishHistoryEntry(exitStatus);
+        //since I am interpreting the instructions as fully exiting all scripts when any error occurs, this clears the queue and rethrows to main
+        //many of these functions can produce errors, all of these get passed back to main and handled there
+        clearScripts();
+        NOHISTORYFLAG = false;
+        throw e;
+    }
+    
+    return !stopRequested;
+}
+
+void Shell::staticBringJobToFG(Shell* s)
+{
+    s->bringJobToFG();
+}
+
+//a stopped job is continued first, and with job control the job gets the terminal while it runs
+//if it is stopped again it stays in the job map
+void Shell::bringJobToFG()
+{
+    int id;
+    try
+    {
+        id = stoi(tokenList[1]);
+    }
+    catch (std::exception &e)
+    {
+        //if the second arg is not an integer, stoi will throw an exception
+        throw error(RETURNCODE::INVALID_ARG);
+    }
+    
+    //try to find the job in the map
+    //if it exists, get the list of pids and wait for each
+    //otherwise throw an exception
+    std::map<int, bgJob>::iterator it = bgJobQueue.find(id);
+    if (it == bgJobQueue.end())
+        throw error(RETURNCODE::NO_JOB);
+    
+    //anything the reaper already collected isn't waited for again
+    bgJob& job = it->second;
+    if (waitForJob(job, job.stopped))
+    {
+        addStoppedJob(job);
+        exitStatus = 128 + SIGTSTP;
+        return;
+    }
+    addJobToStats(job);
+    exitStatus = jobExitStatus(job);
+    bgJobQueue.erase(it);
+}
+
+void Shell::staticContinueJob(Shell* s)
+{
+    s->continueJob();
+}
+
+//continues a stopped job in the background, like bg in other shells
+//throws INVALID_ARG if the job ID isn't an integer, NO_JOB if there is no job with that ID
+void Shell::continueJob()
+{
+    int id;
+    try
+    {
+        id = stoi(tokenList[1]);
+    }
+    catch (std::exception &e)
+    {
+        throw error(RETURNCODE::INVALID_ARG);
+    }
+    
+    std::map<int, bgJob>::iterator it = bgJobQueue.find(id);
+    if (it == bgJobQueue.end())
+        throw error(RETURNCODE::NO_JOB);
+    
+    bgJob& job = it->second;
+    if (job.stopped)
+    {
+        job.stopped = false;
+        signalJob(job, SIGCONT);
+    }
+    std::cout << "[" << job.jobID << "] " << job.cmd << "\n";
+    return;
+}
+
+void Shell::staticPrintBGJobs(Shell* s)
+{
+    s->printBGJobs();
+}
+
+//prints the Job ID, PID for the first child process in the list (since piped commands might have more than one), the original command, status and start time
+//finished jobs are reported and removed by reapChildren first, so everything left is still running or stopped
+//a pipeline where only some of the commands have finished is shown as Partial
+void Shell::printBGJobs()
+{
+    //as a command of an @ chain this is on the helper thread, and launchPipeline has already reaped
+    if (!runningAsStage)
+        reapChildren();
+    
+    std::string statString;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    std::cout << "Job | PID |  Command  | Status | Elapsed | CPU(done) |   Start Time\n";
+    for (std::map<int, bgJob>::iterator i = bgJobQueue.begin(); i != bgJobQueue.end(); i++)
+    {
+        bgJob& cur = i->second;
+        if (cur.stopped)
+            statString = "Stopped";
+        else if (cur.runningCount == cur.processList.size())
+            statString = "Running";
+        else
+            statString = "Partial";
+        
+        //CPU time is only known for the commands that have already been reaped
+        double cpuTime = 0;
+        for (int j = 0; j < cur.processList.size(); j++)
+        {
+            if (cur.processList[j].finished)
+                cpuTime += timevalSeconds(cur.processList[j].usage.ru_utime) + timevalSeconds(cur.processList[j].usage.ru_stime);
+        }
+        
+        std::cout << std::setw(3) << cur.jobID << std::setw(7) << cur.processList[0].pid << std::setw(10) << cur.cmd << std::setw(11) << statString;
+        std::cout << std::fixed << std::setprecision(2) << std::setw(9) << elapsedSeconds(cur.startClock, now) << std::setw(11) << cpuTime;
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setw(28) << ctime(&cur.startTime); //ctime ends with \n, so no endl here
+    }
+}
+
+void Shell::staticCull(Shell* s)
+{
+    s->cull();
+}
+
+//kill the process (which might actually be a list of processes) specified by the internal Job ID
+//requires exactly two tokens, first is the cull command itself, second is an integer
+//throws an error if there are not exactly two tokens, or if the second token cannot be resolved to int
+//also throws NO_JOB if the job ID is not found in the map
+void Shell::cull()
+{
+    int jobID;
+    try
+    {
+        jobID = stoi(tokenList[1]);
+    }
+    catch (std::exception &e)
+    {
+        //if the second arg is not an integer, stoi will throw an exception
+        throw error(RETURNCODE::INVALID_ARG);
+    }
+    
+    //try to find the job in the map
+    //if it exists, send it SIGTERM (see signalJob for how it gets to each process)
+    //otherwise throw an exception
+    std::map<int, bgJob>::iterator it = bgJobQueue.find(jobID);
+    if (it == bgJobQueue.end())
+        throw error(RETURNCODE::NO_JOB);
+    
+    //a stopped job only gets the SIGTERM once it is continued
+    bgJob& job = it->second;
+    signalJob(job, SIGTERM);
+    if (job.stopped)
+    {
+        job.stopped = false;
+        signalJob(job, SIGCONT);
+    }
+    return;
+}
+
+void Shell::staticUsescript(Shell* s)
+{
+    s->usescript();
+}
+
+//opens the script and pushes it onto the front of scriptStack, readCommandLine then reads it one line at a time
+//a script that is already running, under any name, is recursive (this works for both self-recursion or mutual-recursion)
+//with -j N the script is instead run right away by runParallel, and -k keeps its output in script order
+//throws FILE_ERROR if the script can't be opened, RECURSIVE_SCRIPT if it is already running
+//throws INVALID_ARG if N isn't a positive integer
+void Shell::usescript()
+{
+    std::string scriptname = "";
+    int slots = 0;
+    bool ordered = false;
+    for (int i = 1; i < tokenList.size(); i++)
+    {
+        if (tokenList[i] == "-j")
+        {
+            if (i + 1 >= tokenList.size())
+                throw error(RETURNCODE::TOO_FEW_ARGS);
+            slots = parseSlotCount(tokenList[i + 1]);
+            i++;
+        }
+        else if (tokenList[i] == "-k")
+            ordered = true;
+        else if (scriptname == "")
+            scriptname = tokenList[i];
+        else
+            throw error(RETURNCODE::TOO_MANY_ARGS);
+    }
+    if (scriptname == "")
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    struct stat fileStruct;
+    if (stat(scriptname.c_str(), &fileStruct) == -1)
+        throw error(RETURNCODE::FILE_ERROR);
+    std::pair<dev_t, ino_t> identity(fileStruct.st_dev, fileStruct.st_ino);
+    if (openScripts.count(identity) != 0)
+        throw error(RETURNCODE::RECURSIVE_SCRIPT);
+    
+    std::unique_ptr<scriptFile> script(new scriptFile(scriptname, fileStruct.st_dev, fileStruct.st_ino));
+    
+    //if the script has already been compiled (and hasn't changed since), it runs from the cache and the file isn't even opened
+    script->cache = (slots > 0) ? NULL : findCompiledScript(scriptname, fileStruct);
+    if (script->cache == NULL)
+    {
+        //the buffer has to be set before the file is opened
+        script->file.rdbuf()->pubsetbuf(script->buffer.data(), script->buffer.size());
+        script->file.open(scriptname);
+        if (!script->file)
+            throw error (RETURNCODE::FILE_ERROR);
+    }
+    
+    if (slots > 0)
+    {
+        //runParallel needs every line up front so it can schedule them
+        std::deque<std::string> lines;
+        std::string command;
+        while (getline(script->file, command))
+            lines.push_back(command);
+        script->file.close();
+        
+        openScripts.insert(identity);
+        try
+        {
+            runParallel(lines, slots, ordered, !batchMode);
+        }
+        catch (error const &e)
+        {
+            openScripts.erase(identity);
+            throw e;
+        }
+        openScripts.erase(identity);
+        return;
+    }
+    
+    //otherwise each line is compiled as it is read the first time, and the cache entry is complete once the script reaches the end
+    if (script->cache == NULL)
+    {
+        compiledScript& entry = scriptCache[identity];
+        entry = compiledScript();
+        entry.name = scriptname;
+        entry.mtime = fileStruct.st_mtim;
+        entry.size = fileStruct.st_size;
+        script->cache = &entry;
+        script->recording = true;
+    }
+    
+    openScripts.insert(identity);
+    scriptStack.push_front(std::move(script));
+    return;
+}
+
+//closes the script at the front of scriptStack once it has run out of lines
+//a script that stopped partway through (because of an error) leaves an incomplete cache entry, which is thrown away
+void Shell::popScript()
+{
+    std::pair<dev_t, ino_t> identity(scriptStack[0]->device, scriptStack[0]->inode);
+    if (scriptStack[0]->recording && scriptStack[0]->cache != NULL && !scriptStack[0]->cache->complete)
+        scriptCache.erase(identity);
+    openScripts.erase(identity);
+    scriptStack.pop_front();
+    return;
+}
+
+//puts the next line of the script in currentLine, and its compiled form in currentCompiled if it has one
+//while recording, the line comes from the file and gets added to the cache, otherwise it comes straight from the cache
+//scripts that turn out to be longer than SCRIPT_CACHE_MAX_LINES stop recording and are just streamed from then on
+//returns false once the script has no more lines
+bool Shell::readScriptLine(scriptFile& script)
+{
+    if (script.cache != NULL && !script.recording)
+    {
+        if (script.nextLine == script.cache->lines.size())
+            return false;
+        compiledLine& line = script.cache->lines[script.nextLine++];
+        currentLine = line.raw;
+        if (line.compiled)
+            currentCompiled = &line;
+        return true;
+    }
+    
+    if (!getline(script.file, currentLine))
+    {
+        if (script.recording)
+        {
+            script.cache->complete = true;
+            script.recording = false;
+            script.cache = NULL;
+        }
+        return false;
+    }
+    
+    if (script.recording)
+    {
+        if (script.cache->lines.size() == SCRIPT_CACHE_MAX_LINES)
+        {
+            scriptCache.erase(std::pair<dev_t, ino_t>(script.device, script.inode));
+            script.cache = NULL;
+            script.recording = false;
+        }
+        else
+        {
+            script.cache->lines.push_back(compileLine(currentLine));
+            if (script.cache->lines.back().compiled)
+                currentCompiled = &script.cache->lines.back();
+        }
+    }
+    return true;
+}
+
+//does the file-only part of compiling a script line: the same comment and blank handling as readCommandLine, then tokenizing
+//blank lines and ! lines are left uncompiled, since those have to go through readCommandLine every time
+compiledLine Shell::compileLine(std::string raw)
+{
+    compiledLine line;
+    line.raw = raw;
+    
+    lexLine(raw, lexed, true);
+    if (lexed.tokens.empty() || lexed.text[0] == '!')
+        return line;
+    
+    line.text = lexed.text;
+    for (int i = 0; i < lexed.tokens.size(); i++)
+    {
+        line.tokens.push_back(std::string(lexed.tokens[i]));
+        line.quoted.push_back(lexed.quoted[i]);
+    }
+    line.compiled = true;
+    return line;
+}
+
+//returns the script's cache entry if it is complete and was compiled from the file as it is now (same modification time and size)
+//if it isn't in memory, a compiled copy saved next to the script by "scriptcache save" is loaded instead
+//returns NULL if there is no usable compiled copy, and throws away any stale one
+compiledScript* Shell::findCompiledScript(std::string scriptname, const struct stat& fileStruct)
+{
+    std::pair<dev_t, ino_t> identity(fileStruct.st_dev, fileStruct.st_ino);
+    std::map<std::pair<dev_t, ino_t>, compiledScript>::iterator it = scriptCache.find(identity);
+    if (it != scriptCache.end())
+    {
+        compiledScript& cached = it->second;
+        if (cached.complete && cached.size == fileStruct.st_size && cached.mtime.tv_sec == fileStruct.st_mtim.tv_sec && cached.mtime.tv_nsec == fileStruct.st_mtim.tv_nsec)
+            return &cached;
+        scriptCache.erase(it);
+    }
+    
+    compiledScript loaded;
+    if (!loadCompiledScript(scriptname + COMPILED_SCRIPT_SUFFIX, fileStruct, loaded))
+        return NULL;
+    loaded.name = scriptname;
+    compiledScript& entry = scriptCache[identity];
+    entry = loaded;
+    return &entry;
+}
+
+//saves the file-only part of a compiled script: a header with the script's modification time and size, then every line
+//each string is written as its length followed by its bytes, and each token with whether it was quoted, so loading it back doesn't need any tokenizing
+//returns false if the file couldn't be written
+bool Shell::writeCompiledScript(std::string fileName, const compiledScript& script)
+{
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    
+    file << COMPILED_SCRIPT_MAGIC << "\n" << script.mtime.tv_sec << " " << script.mtime.tv_nsec << " " << script.size << " " << script.lines.size() << "\n";
+    for (int i = 0; i < script.lines.size(); i++)
+    {
+        const compiledLine& line = script.lines[i];
+        file << line.compiled << " " << line.raw.size() << " ";
+        file.write(line.raw.data(), line.raw.size());
+        file << " " << line.text.size() << " ";
+        file.write(line.text.data(), line.text.size());
+        file << " " << line.tokens.size();
+        for (int j = 0; j < line.tokens.size(); j++)
+        {
+            file << " " << line.quoted[j] << " " << line.tokens[j].size() << " ";
+            file.write(line.tokens[j].data(), line.tokens[j].size());
+        }
+        file << "\n";
+    }
+    return file.good();
+}
+
+//loads a compiled script saved by writeCompiledScript into script
+//returns false if the file doesn't exist, is damaged, or was compiled from a different version of the script
+bool Shell::loadCompiledScript(std::string fileName, const struct stat& fileStruct, compiledScript& script)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+        return false;
+    
+    //every length and count is checked against the size of the file, since a truncated or damaged file could otherwise ask for any amount of memory
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    
+    std::string magic;
+    size_t lineCount;
+    file >> magic >> script.mtime.tv_sec >> script.mtime.tv_nsec >> script.size >> lineCount;
+    if (!file || magic != COMPILED_SCRIPT_MAGIC || script.size != fileStruct.st_size || script.mtime.tv_sec != fileStruct.st_mtim.tv_sec || script.mtime.tv_nsec != fileStruct.st_mtim.tv_nsec)
+        return false;
+    //each line takes at least a few bytes, so there can't be more lines than bytes left
+    if (lineCount > (size_t) (fileSize - file.tellg()))
+        return false;
+    
+    for (size_t i = 0; i < lineCount; i++)
+    {
+        compiledLine line;
+        size_t tokenCount;
+        file >> line.compiled;
+        if (!readCachedString(file, fileSize, line.raw) || !readCachedString(file, fileSize, line.text))
+            return false;
+        file >> tokenCount;
+        if (!file || tokenCount > (size_t) (fileSize - file.tellg()))
+            return false;
+        for (size_t j = 0; j < tokenCount; j++)
+        {
+            bool quoted;
+            std::string token;
+            file >> quoted;
+            if (!readCachedString(file, fileSize, token))
+                return false;
+            line.tokens.push_back(token);
+            line.quoted.push_back(quoted);
+        }
+        if (line.compiled && line.tokens.empty())
+            return false;
+        script.lines.push_back(line);
+    }
+    script.complete = true;
+    return true;
+}
+
+//closes every running script, since an error anywhere ends all of them
+void Shell::clearScripts()
+{
+    while (scriptStack.size() != 0)
+        popScript();
+    return;
+}
+
+void Shell::staticParallel(Shell* s)
+{
+    s->parallel();
+}
+
+//runs a command once per argument after :::, with at most N running at the same time
+//each {} token in the command is replaced by the argument, if there are none the argument is added to the end
+//-k prints the output in argument order rather than as each command finishes
+//throws TOO_FEW_ARGS if there is no N or no command, BAD_SYNTAX if there is no :::, INVALID_ARG if N isn't a positive integer
+void Shell::parallel()
+{
+    int pos = 1;
+    bool ordered = false;
+    if (pos < tokenList.size() && tokenList[pos] == "-k")
+    {
+        ordered = true;
+        pos++;
+    }
+    if (tokenList.size() < pos + 2)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    int slots = parseSlotCount(tokenList[pos]);
+    pos++;
+    
+    int separator = pos;
+    while (separator < tokenList.size() && !isOperator(separator, ":::"))
+        separator++;
+    if (separator == tokenList.size())
+        throw error(RETURNCODE::BAD_SYNTAX);
+    if (separator == pos)
+        throw error(RETURNCODE::TOO_FEW_ARGS);
+    
+    bool placeholder = false;
+    for (int j = pos; j < separator; j++)
+        placeholder = placeholder || isOperator(j, "{}");
+    std::deque<std::string> lines;
+    for (int i = separator + 1; i < tokenList.size(); i++)
+    {
+        std::string line;
+        for (int j = pos; j < separator; j++)
+        {
+            if (j != pos)
+                line += " ";
+            //the arguments are always quoted so they stay one word each, the command only where it was quoted to begin with
+            if (isOperator(j, "{}"))
+                line += quoteWord(tokenList[i]);
+            else
+                line += tokenIsQuoted(j) ? quoteWord(tokenList[j]) : tokenList[j];
+        }
+        if (!placeholder)
+            line += " " + quoteWord(tokenList[i]);
+        lines.push_back(line);
     }
-    newScript.push_back(scriptname); //adding the script name itself to the queue
-    scriptStack.push_front(newScript);
     
-    file.close();
+    runParallel(lines, slots, ordered, false);
+    return;
+}
+
+//converts the N of parallel and usescript -j to an int
+//throws INVALID_ARG if it isn't a positive integer
+int Shell::parseSlotCount(std::string token)
+{
+    int slots;
+    try
+    {
+        slots = stoi(token);
+    }
+    catch (std::exception &e)
+    {
+        throw error(RETURNCODE::INVALID_ARG);
+    }
+    if (slots < 1)
+        throw error(RETURNCODE::INVALID_ARG);
+    return slots;
+}
+
+//runs every line with at most slots of them going at once, starting the next one as soon as the reaper frees a slot
+//each line's stdout is collected in a memfd and printed (after the line itself if echoCommands is set) once it finishes,
+//or once it and every line before it has finished if ordered is set
+//internal commands can't run alongside anything else, so they wait for every running line to finish and then run in the shell
+//a line that fails doesn't stop the others, and exitStatus is left at 1 if any of them failed
+//stop in one of the lines stops any more from starting
+void Shell::runParallel(std::deque<std::string> lines, int slots, bool ordered, bool echoCommands)
+{
+    //each line is parsed through tokenList, which still holds the words of the command that called this, and runCommandTree puts those back in its tree
+    std::deque<std::string> savedTokens;
+    std::deque<bool> savedQuoted;
+    savedTokens.swap(tokenList);
+    savedQuoted.swap(tokenQuoted);
+    
+    std::vector<parallelTask> tasks;
+    for (int i = 0; i < lines.size(); i++)
+    {
+        //same comment and blank line handling as readCommandLine
+        try
+        {
+            lexLine(lines[i], lexed, true);
+        }
+        catch (error const &e)
+        {
+            //an unterminated quote, left for the task to report when it fails to start
+            tasks.push_back(parallelTask(lines[i]));
+            continue;
+        }
+        if (lexed.tokens.empty())
+            continue;
+        tasks.push_back(parallelTask(lexed.text));
+    }
+    
+    std::map<int, bgJob> runningJobs; //task index -> its job, for as long as it is running
+    int nextTask = 0, nextToPrint = 0;
+    bool failed = false;
+    
+    while ((nextTask < tasks.size() && !stopRequested) || !runningJobs.empty())
+    {
+        //start as many lines as there are free slots
+        while (runningJobs.size() < slots && nextTask < tasks.size() && !stopRequested)
+        {
+            parallelTask& task = tasks[nextTask];
+            commandList list;
+            bool internal = false;
+            currentLine = task.line;
+            try
+            {
+                //comments were already stripped above
+                lexLine(currentLine, lexed, false);
+                setTokens();
+                parseCommandList(list);
+                //a line with ; && or || runs its commands one after the other, so it is treated like an internal command
+                internal = list.commands.size() > 1 || list.commands[0].function != &staticRunLinuxCommand;
+                //so is an @ chain with an internal command in it, since that command runs in the shell as well
+                for (int i = 0; !internal && i < list.commands[0].stages.size(); i++)
+                    internal = list.commands[0].stages[i].builtin != NULL;
+                if (!internal)
+                {
+                    commandTree& tree = list.commands[0];
+                    bool guarded = true;
+                    for (int i = 0; i < tree.guards.size(); i++)
+                        guarded = guarded && checkGuard(tree.guards[i]);
+                    if (guarded)
+                    {
+                        struct timespec launchClock;
+                        pid_t pgid;
+                        task.outputFD = memfd_create("parallel", MFD_CLOEXEC);
+                        std::vector<pid_t> childList = launchPipeline(tree, task.outputFD, launchClock, pgid);
+                        runningJobs.insert(std::pair<int, bgJob>(nextTask, createJob(0, tree, childList, launchClock, pgid)));
+                    }
+                    else
+                        task.finished = true;
+                    commandCount++;
+                }
+            }
+            catch (error const &e)
+            {
+                //this line couldn't even be started, eg a missing [ file or a recursive alias
+                std::cerr << "Unable to start: " << task.line << "\n";
+                task.finished = true;
+                task.failed = true;
+                failed = true;
+            }
+            
+            if (internal)
+            {
+                //wait for the running lines to finish first, this one gets retried once they have
+                if (!runningJobs.empty())
+                    break;
+                while (nextToPrint < nextTask)
+                    printParallelTask(tasks[nextToPrint++], echoCommands);
+                if (echoCommands)
+                    std::cout << task.line << std::endl;
+                task.printed = true;
+                //an internal command that fails just fails this line, only a fatal error ends the run the way it ends a normal script
+                try
+                {
+                    runCommandList(list);
+                }
+                catch (...)
+                {
+                    tokenList.swap(savedTokens);
+                    tokenQuoted.swap(savedQuoted);
+                    throw;
+                }
+                if (exitStatus != 0)
+                {
+                    task.failed = true;
+                    failed = true;
+                }
+                task.finished = true;
+            }
+            nextTask++;
+        }
+        
+        if (!runningJobs.empty())
+        {
+            //sleep until a process of one of the running lines exits, then collect everything that has finished
+            //background jobs are left for reapChildren, which reports them before the next prompt as usual
+            std::vector<bgJob*> jobs;
+            for (std::map<int, bgJob>::iterator it = runningJobs.begin(); it != runningJobs.end(); it++)
+                jobs.push_back(&it->second);
+            waitForProcesses(jobs, -1);
+            
+            std::map<int, bgJob>::iterator it = runningJobs.begin();
+            while (it != runningJobs.end())
+            {
+                int index = it->first;
+                bgJob& job = it->second;
+                if (job.runningCount > 0)
+                {
+                    it++;
+                    continue;
+                }
+                if (jobExitStatus(job) != 0)
+                    tasks[index].failed = true;
+                addJobToStats(job);
+                it = runningJobs.erase(it);
+                tasks[index].finished = true;
+                if (tasks[index].failed)
+                    failed = true;
+                if (!ordered)
+                    printParallelTask(tasks[index], echoCommands);
+            }
+        }
+        
+        if (ordered)
+        {
+            while (nextToPrint < tasks.size() && tasks[nextToPrint].finished)
+                printParallelTask(tasks[nextToPrint++], echoCommands);
+        }
+    }
+    
+    //unordered runs print as they go, but lines that failed to start are only printed here
+    for (int i = 0; i < tasks.size(); i++)
+        printParallelTask(tasks[i], echoCommands);
+    
+    tokenList.swap(savedTokens);
+    tokenQuoted.swap(savedQuoted);
+    exitStatus = failed ? 1 : 0;
+    return;
+}
+
+//the exit status of a foreground or background job once every command in it has finished
+//the job failed if any of its commands did, and its status is that of the last one that failed, the way pipefail works in other shells
+//a command killed by a signal counts as 128 plus the signal number
+int Shell::jobExitStatus(const bgJob& job)
+{
+    int result = 0;
+    for (int i = 0; i < job.processList.size(); i++)
+    {
+        int status = job.processList[i].status;
+        if (status == 0)
+            continue;
+        result = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    return result;
+}
+
+//prints a finished parallel line (if echoCommands is set) followed by everything it wrote to stdout, then closes its memfd
+//does nothing if the task was already printed
+void Shell::printParallelTask(parallelTask& task, bool echoCommands)
+{
+    if (task.printed)
+        return;
+    task.printed = true;
+    if (echoCommands)
+        std::cout << task.line << "\n";
+    std::cout.flush();
+    if (task.outputFD != -1)
+    {
+        lseek(task.outputFD, 0, SEEK_SET);
+        transferData(task.outputFD, STDOUT_FILENO);
+        close(task.outputFD);
+        task.outputFD = -1;
+    }
     return;
 }
 
@@ -1315,11 +3995,11 @@ void Shell::staticOutput(Shell* s)
 
 void Shell::output()
 {
-    commandCount++;  //since this command never makes it to execCommand(), I manually increment the count here
     for (int i = 1; i < tokenList.size(); i++)
         std::cout << tokenList[i] << " ";
     std::cout << std::endl;
-    throw error(RETURNCODE::OUTPUT_COMMAND);  //technically not an error, but works to return control back to main
+    exitStatus = 0;
+    return;
 }
 
 void Shell::staticExit(Shell* s)
@@ -1327,9 +4007,488 @@ void Shell::staticExit(Shell* s)
     s->exit();
 }
 
-//tells the program to exit
+//tells the program to exit once the current line is done
 void Shell::exit()
 {
-    //technically not an error, but this is a handy way to tell main to exit using existing functionality
-    throw error(RETURNCODE::EXIT);
+    stopRequested = true;
+    return;
+}
+
+void Shell::staticHashCommand(Shell* s)
+{
+    s->hashCommand();
+}
+
+//prints or manages the command hash table, like bash's hash builtin
+//"hash" prints every remembered command, "hash -r" forgets them all
+//"hash name ..." looks each name up and remembers it
+//throws CMD_NOT_FOUND if one of the given names isn't in $PATH
+void Shell::hashCommand()
+{
+    if (tokenList.size() == 1)
+    {
+        if (commandHashTable.empty())
+            std::cout << "hash table empty\n";
+        for (std::unordered_map<std::string, std::string>::iterator it = commandHashTable.begin(); it != commandHashTable.end(); it++)
+            std::cout << it->first << "\t" << it->second << "\n";
+        return;
+    }
+    
+    if (tokenList[1] == "-r")
+    {
+        if (tokenList.size() > 2)
+            throw error(RETURNCODE::TOO_MANY_ARGS);
+        commandHashTable.clear();
+        return;
+    }
+    
+    for (int i = 1; i < tokenList.size(); i++)
+    {
+        if (findCommandPath(tokenList[i]) == "")
+            throw error(RETURNCODE::CMD_NOT_FOUND);
+    }
+    return;
+}
+
+void Shell::staticSetLauncher(Shell* s)
+{
+    s->setLauncher();
+}
+
+//switches between posix_spawn and fork for starting linux commands
+//throws INVALID_ARG if the second token isn't spawn or fork
+void Shell::setLauncher()
+{
+    if (tokenList[1] == "spawn")
+        spawnMode = true;
+    else if (tokenList[1] == "fork")
+        spawnMode = false;
+    else
+        throw error(RETURNCODE::INVALID_ARG);
+    return;
+}
+
+void Shell::staticTransfer(Shell* s)
+{
+    s->transfer();
+}
+
+//transfer is just a pipeline stage that happens to be implemented by the shell
+//runLinuxCommand already handles its redirection, piping and background mode, so it is started the same way as any other command
+void Shell::transfer()
+{
+    runLinuxCommand();
+    return;
+}
+
+void Shell::staticPrintJobStats(Shell* s)
+{
+    s->printJobStats();
+}
+
+//prints the exit code, wall time, CPU time and max RSS of every command of the recently finished jobs, one line per command
+//this is meant to show which stage of a pipeline is the bottleneck without having to wrap it in /usr/bin/time
+void Shell::printJobStats()
+{
+    if (!runningAsStage)
+        reapChildren();
+    
+    if (jobStatsList.size() == 0)
+    {
+        std::cout << "No finished jobs to display\n";
+        return;
+    }
+    
+    std::cout << "Job |  PID  |  Exit  | Wall(s) | User(s) | Sys(s) | MaxRSS(KB) | Command\n";
+    std::cout << std::fixed << std::setprecision(3);
+    for (int i = 0; i < jobStatsList.size(); i++)
+    {
+        bgJob& job = jobStatsList[i];
+        for (int j = 0; j < job.processList.size(); j++)
+        {
+            bgProcess& process = job.processList[j];
+            std::string exitString;
+            if (WIFEXITED(process.status))
+                exitString = std::to_string(WEXITSTATUS(process.status));
+            else if (WIFSIGNALED(process.status))
+                exitString = "sig" + std::to_string(WTERMSIG(process.status));
+            
+            if (j == 0)
+                std::cout << std::setw(3) << (job.jobID == 0 ? "fg" : std::to_string(job.jobID));
+            else
+                std::cout << std::setw(3) << "";
+            std::cout << std::setw(8) << process.pid << std::setw(8) << exitString;
+            std::cout << std::setw(10) << elapsedSeconds(job.startClock, process.endClock);
+            std::cout << std::setw(10) << timevalSeconds(process.usage.ru_utime) << std::setw(9) << timevalSeconds(process.usage.ru_stime);
+            std::cout << std::setw(13) << process.usage.ru_maxrss << "   " << process.cmd << "\n";
+        }
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+    return;
+}
+
+void Shell::staticScriptCacheCommand(Shell* s)
+{
+    s->scriptCacheCommand();
+}
+
+//manages the compiled scripts kept by usescript
+//"scriptcache" lists them, "scriptcache clear" forgets them (except any that are running right now)
+//"scriptcache save filename" compiles the script and saves it next to it, so it is loaded already compiled even by a new shell
+//throws FILE_ERROR if the script can't be read or the compiled copy can't be written, INVALID_ARG for an unknown option
+void Shell::scriptCacheCommand()
+{
+    if (tokenList.size() == 1)
+    {
+        if (scriptCache.empty())
+            std::cout << "No compiled scripts\n";
+        for (std::map<std::pair<dev_t, ino_t>, compiledScript>::iterator it = scriptCache.begin(); it != scriptCache.end(); it++)
+            std::cout << it->second.name << ": " << it->second.lines.size() << " lines" << (it->second.complete ? "" : " (compiling)") << "\n";
+        return;
+    }
+    
+    if (tokenList[1] == "clear")
+    {
+        if (tokenList.size() > 2)
+            throw error(RETURNCODE::TOO_MANY_ARGS);
+        for (std::map<std::pair<dev_t, ino_t>, compiledScript>::iterator it = scriptCache.begin(); it != scriptCache.end(); )
+        {
+            if (openScripts.count(it->first) == 0)
+                it = scriptCache.erase(it);
+            else
+                it++;
+        }
+        return;
+    }
+    
+    if (tokenList[1] == "save")
+    {
+        if (tokenList.size() < 3)
+            throw error(RETURNCODE::TOO_FEW_ARGS);
+        
+        std::string scriptname = tokenList[2];
+        struct stat fileStruct;
+        std::ifstream file(scriptname);
+        if (!file || stat(scriptname.c_str(), &fileStruct) == -1)
+            throw error(RETURNCODE::FILE_ERROR);
+        
+        compiledScript compiled;
+        compiled.name = scriptname;
+        compiled.mtime = fileStruct.st_mtim;
+        compiled.size = fileStruct.st_size;
+        std::string line;
+        while (getline(file, line))
+            compiled.lines.push_back(compileLine(line));
+        compiled.complete = true;
+        
+        if (!writeCompiledScript(scriptname + COMPILED_SCRIPT_SUFFIX, compiled))
+            throw error(RETURNCODE::FILE_ERROR);
+        
+        std::pair<dev_t, ino_t> identity(fileStruct.st_dev, fileStruct.st_ino);
+        if (openScripts.count(identity) == 0)
+            scriptCache[identity] = compiled;
+        return;
+    }
+    
+    throw error(RETURNCODE::INVALID_ARG);
+}
+
+void Shell::staticSetAliasSize(Shell* s)
+{
+    s->setAliasSize();
+}
+
+//sets how many aliases are kept, dropping the least recently used ones if there are already more than that
+//with no arguments, prints the size and how full the list is
+//throws INVALID_ARG if the argument isn't a positive number
+void Shell::setAliasSize()
+{
+    if (tokenList.size() == 1)
+    {
+        std::cout << aliasList.size() << " of " << maxAliasSize << " aliases in use\n";
+        return;
+    }
+    
+    maxAliasSize = parseSlotCount(tokenList[1]);
+    trimAliasList(maxAliasSize);
+    return;
+}
+
+void Shell::staticSetHistorySize(Shell* s)
+{
+    s->setHistorySize();
+}
+
+//sets how many commands the history ring keeps, moving the most recent ones into a ring of the new size
+//with no arguments, prints the size and how full the ring is
+//throws INVALID_ARG if the argument isn't a positive number
+void Shell::setHistorySize()
+{
+    if (tokenList.size() == 1)
+    {
+        std::cout << historyCount << " of " << maxHistorySize << " history entries in use\n";
+        return;
+    }
+    
+    int size = parseSlotCount(tokenList[1]);
+    std::vector<historySlot> resized(size);
+    size_t kept = std::min(historyCount, (size_t) size);
+    for (size_t i = 0; i < historyCount; i++)
+    {
+        const historySlot& slot = historyRing[(historyHead + i) % historyRing.size()];
+        if (i < historyCount - kept)
+            releaseHistoryString(slot.command);
+        else
+            resized[i - (historyCount - kept)] = slot;
+    }
+    historyRing.swap(resized);
+    historyHead = 0;
+    historyCount = kept;
+    maxHistorySize = size;
+    return;
+}
+
+void Shell::staticSetUtilities(Shell* s)
+{
+    s->setUtilities();
+}
+
+//chooses whether the commands in utilityTable are run by the shell or as real programs
+//throws INVALID_ARG for anything but shell or linux
+void Shell::setUtilities()
+{
+    if (tokenList[1] == "shell")
+        utilityMode = true;
+    else if (tokenList[1] == "linux")
+        utilityMode = false;
+    else
+        throw error(RETURNCODE::INVALID_ARG);
+    return;
+}
+
+//UTILITIES
+//each one gets the whole command (args[0] is its name) and the fds to use for stdin and stdout, and returns the exit status like the real program would
+//errors go to stderr with the status, rather than throwing, since a failing utility is just a command that failed
+
+//echo [-neE] [args]
+//-n leaves off the newline, -e turns on backslash escapes and -E turns them off again
+int Shell::echoUtility(Shell*, const std::deque<std::string>& args, int, int outFD)
+{
+    bool newline = true, escapes = false;
+    size_t i = 1;
+    for (; i < args.size(); i++)
+    {
+        const std::string& word = args[i];
+        if (word.size() < 2 || word[0] != '-' || word.find_first_not_of("neE", 1) != std::string::npos)
+            break;
+        for (size_t j = 1; j < word.size(); j++)
+        {
+            if (word[j] == 'n')
+                newline = false;
+            else
+                escapes = (word[j] == 'e');
+        }
+    }
+    
+    std::string out;
+    bool stop = false;
+    for (size_t first = i; i < args.size() && !stop; i++)
+    {
+        if (i > first)
+            out += ' ';
+        if (!escapes)
+        {
+            out += args[i];
+            continue;
+        }
+        for (size_t j = 0; j < args[i].size() && !stop; j++)
+        {
+            if (args[i][j] == '\\')
+                j = appendEscape(args[i], j, out, true, stop);
+            else
+                out += args[i][j];
+        }
+    }
+    if (newline && !stop)
+        out += '\n';
+    return writeAll(outFD, out.data(), out.size()) ? 0 : 1;
+}
+
+//cat [files]
+//with no files, or for -, copies stdin.  Any option is left to the real cat,
+//and so is reading a terminal, since the shell ignores ctrl-c and ctrl-z and only a real process can be stopped or interrupted
+int Shell::catUtility(Shell* s, const std::deque<std::string>& args, int inFD, int outFD)
+{
+    bool readsInput = (args.size() == 1);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args[i].size() > 1 && args[i][0] == '-')
+            return -1;
+        if (args[i] == "-")
+            readsInput = true;
+    }
+    if (readsInput && isatty(inFD))
+        return -1;
+    if (args.size() == 1)
+        return s->transferData(inFD, outFD) ? 0 : 1;
+    
+    int status = 0;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (args[i] == "-")
+        {
+            if (!s->transferData(inFD, outFD))
+                status = 1;
+            continue;
+        }
+        int file = open(args[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+        {
+            std::cerr << "cat: " << args[i] << ": " << strerror(errno) << "\n";
+            status = 1;
+            continue;
+        }
+        if (!s->transferData(file, outFD))
+        {
+            std::cerr << "cat: " << args[i] << ": " << strerror(errno) << "\n";
+            status = 1;
+        }
+        close(file);
+    }
+    return status;
+}
+
+int Shell::trueUtility(Shell*, const std::deque<std::string>&, int, int)
+{
+    return 0;
+}
+
+int Shell::falseUtility(Shell*, const std::deque<std::string>&, int, int)
+{
+    return 1;
+}
+
+//test expression
+//supports ! ( ) -a -o, the file tests -e -f -d -r -w -x -s -L -h -b -c -p -S, -z and -n,
+//and the comparisons = == != < > -eq -ne -lt -le -gt -ge -nt -ot -ef
+//returns 0 if the expression is true, 1 if it's false and 2 if it can't be read
+int Shell::testUtility(Shell*, const std::deque<std::string>& args, int, int)
+{
+    std::vector<std::string> expression(args.begin() + 1, args.end());
+    if (expression.empty())
+        return 1;
+    size_t pos = 0;
+    bool valid = true;
+    bool result = testOr(expression, pos, valid);
+    if (!valid || pos != expression.size())
+    {
+        std::cerr << "test: bad expression\n";
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+//printf format [args]
+//the format is used again for as long as there are arguments left, and missing arguments count as empty or 0
+//supports %% and the conversions d i o u x X f F e E g G c s b, with flags, width and precision
+int Shell::printfUtility(Shell*, const std::deque<std::string>& args, int, int outFD)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "printf: missing format\n";
+        return 1;
+    }
+    const std::string& format = args[1];
+    size_t next = 2;
+    int status = 0;
+    bool stop = false;
+    std::string out;
+    
+    do
+    {
+        size_t firstArg = next;
+        for (size_t i = 0; i < format.size() && !stop; i++)
+        {
+            if (format[i] == '\\')
+            {
+                i = appendEscape(format, i, out, false, stop);
+                continue;
+            }
+            if (format[i] != '%')
+            {
+                out += format[i];
+                continue;
+            }
+            if (i + 1 < format.size() && format[i + 1] == '%')
+            {
+                out += '%';
+                i++;
+                continue;
+            }
+            
+            //the spec is handed to snprintf as it is, so only the characters it understands are let through
+            size_t end = format.find_first_not_of("-+ #0123456789.", i + 1);
+            if (end == std::string::npos || std::string("diouxXfFeEgGcsb").find(format[end]) == std::string::npos)
+            {
+                std::cerr << "printf: bad conversion in " << format << "\n";
+                return 1;
+            }
+            std::string spec = format.substr(i, end - i);
+            char conversion = format[end];
+            std::string arg = (next < args.size()) ? args[next++] : "";
+            i = end;
+            
+            if (conversion == 'd' || conversion == 'i' || conversion == 'o' || conversion == 'u' || conversion == 'x' || conversion == 'X')
+            {
+                long long value = 0;
+                //a quote in front gives the value of the next character, eg printf %d "'A"
+                if (arg.size() > 1 && (arg[0] == '\'' || arg[0] == '"'))
+                    value = (unsigned char) arg[1];
+                else if (!arg.empty() && !parseInteger(arg, value, 0))
+                {
+                    std::cerr << "printf: " << arg << ": invalid number\n";
+                    status = 1;
+                }
+                appendFormatted(out, spec + "ll" + conversion, value);
+            }
+            else if (conversion == 'c')
+            {
+                if (!arg.empty())
+                    appendFormatted(out, spec + 'c', (int) (unsigned char) arg[0]);
+            }
+            else if (conversion == 's')
+                appendFormatted(out, spec + 's', arg.c_str());
+            else if (conversion == 'b')
+            {
+                std::string expanded;
+                for (size_t j = 0; j < arg.size() && !stop; j++)
+                {
+                    if (arg[j] == '\\')
+                        j = appendEscape(arg, j, expanded, true, stop);
+                    else
+                        expanded += arg[j];
+                }
+                appendFormatted(out, spec + 's', expanded.c_str());
+            }
+            else
+            {
+                char* endPtr;
+                double value = arg.empty() ? 0 : strtod(arg.c_str(), &endPtr);
+                if (!arg.empty() && *endPtr != '\0')
+                {
+                    std::cerr << "printf: " << arg << ": invalid number\n";
+                    status = 1;
+                }
+                appendFormatted(out, spec + conversion, value);
+            }
+        }
+        //a format with no conversions in it is only printed once
+        if (next == firstArg)
+            break;
+    } while (next < args.size() && !stop);
+    
+    if (!writeAll(outFD, out.data(), out.size()))
+        return 1;
+    return status;
 }
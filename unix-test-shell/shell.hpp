@@ -5,25 +5,77 @@
 #define shell_hpp
 
 #include <string.h> //for strdup
+#include <string_view>  //the lexer's tokens are views into the line rather than copies
 #include <iostream>
 #include <fstream>  //for c++ file input/output
 #include <fcntl.h>  //for c file input/output, needed for dup2
 #include <sstream>  //for istringstream, used to parse tokens
 #include <deque> //my primary data structure
+#include <iterator>  //for make_move_iterator, used to move a command's words into its tree
 #include <map>  //used for function address maps
-#include <forward_list> //used in Shell::parseAliases()
+#include <unordered_map>  //used for the command hash table
+#include <list>  //holds the aliases in least to most recently used order
 #include <regex>  //used to parse whitespace, only works for gcc version > 4.9
 #include <unistd.h>
 #include <ctime>
 #include <iomanip>
 #include <sys/wait.h>  //older versions of gcc don't seem to know how to handle the return value if this isn't included, even though the return value is just an int
 #include <sys/stat.h>
+#include <sys/time.h>  //for timersub
+#include <sys/resource.h>  //for struct rusage, filled in by wait4
+#include <signal.h>  //for the SIGCHLD handler
+#include <poll.h>  //for waiting on pidfds and the SIGCHLD self-pipe
+#include <sys/syscall.h>  //for pidfd_open and pidfd_send_signal, which glibc has no wrappers for
+#include <termios.h>  //for handing the terminal to the foreground job
+#include <sys/mman.h>  //for memfd_create, which holds the output of parallel commands, and mmap for alias files
+#include <spawn.h>  //for posix_spawn, the default way of launching linux commands
+#include <sys/sendfile.h>  //for sendfile, used by the transfer command
 #include <limits>
+#include <algorithm>  //for std::find
+#include <memory>  //for unique_ptr, used to hold open scripts
+#include <set>  //used for the identities of open scripts
+#include <cstdint>  //fixed width integers for the binary alias snapshot
+#include <array>  //for the builtin table's slots, which are built at compile time
+#include <thread>  //internal commands in an @ chain run on a helper thread
+#include <exception>  //for exception_ptr, which carries an error from that thread back to the shell
+#include <streambuf>
 
 extern char** environ;
 
+//how many finished jobs the jobstats command remembers
+const int JOB_STATS_SIZE = 20;
+
+//size of the read buffer for each script being run by usescript
+const size_t SCRIPT_BUFFER_SIZE = 1 << 16;
+
+//scripts longer than this aren't kept in the script cache, they are just streamed every time
+const size_t SCRIPT_CACHE_MAX_LINES = 100000;
+//compiled scripts saved by "scriptcache save" go next to the script, with this added to the name
+const std::string COMPILED_SCRIPT_SUFFIX = ".tshc";
+const std::string COMPILED_SCRIPT_MAGIC = "TSHC2";
+
+//the persistent history is kept in this file in the user's home directory (or the current directory if $HOME isn't set)
+const std::string HISTORY_FILE_NAME = ".toyshell_history";
+
+//binary alias snapshots written by "savenewnames -b" start with this, which is how readnewnames tells them from text files
+const char ALIAS_SNAPSHOT_MAGIC[4] = {'T', 'S', 'H', 'A'};
+const uint32_t ALIAS_SNAPSHOT_VERSION = 1;
+
+//how many bytes the transfer command asks the kernel to move per call
+const size_t TRANSFER_CHUNK_SIZE = 1 << 20;
+
+//number of entries in the builtin table, and the number of hash slots they are spread over (see Shell::builtinTable in shell.cpp)
+const int BUILTIN_COUNT = 27;
+const int BUILTIN_SLOTS = 128;
+
+//number of small linux utilities the shell can run itself (see Shell::utilityTable in shell.cpp)
+const int UTILITY_COUNT = 6;
+
+//size of the buffer std::cout writes through while an internal command is running as a stage of an @ chain
+const size_t STAGE_BUFFER_SIZE = 1 << 13;
+
 //Internal error codes
-enum class RETURNCODE {EXIT, TOO_FEW_ARGS, TOO_MANY_ARGS, INVALID_ARG, NO_HISTORY, NO_ALIAS, NO_OVERRIDE, RECURSIVE_ALIAS, NO_DELETE, FILE_ERROR, BAD_FORMAT, COMMAND_DNE, BAD_SYNTAX, NO_JOB, PROCESS_ERROR, CMD_NOT_FOUND, RECURSIVE_SCRIPT, OUTPUT_COMMAND, RECURSIVE_REDIRECTION};
+enum class RETURNCODE {TOO_FEW_ARGS, TOO_MANY_ARGS, INVALID_ARG, NO_HISTORY, NO_ALIAS, NO_OVERRIDE, RECURSIVE_ALIAS, NO_DELETE, FILE_ERROR, BAD_FORMAT, COMMAND_DNE, BAD_SYNTAX, NO_JOB, PROCESS_ERROR, CMD_NOT_FOUND, RECURSIVE_SCRIPT, RECURSIVE_REDIRECTION};
 
 //wrapper for my error codes, so that I can throw them as an exception rather than trying to handle return values
 struct error : public std::exception
@@ -32,61 +84,352 @@ struct error : public std::exception
     error(RETURNCODE e) : errorCode(e) {}
 };
 
-/*struct to hold details for each background job */
+bool printError(RETURNCODE); //prints the message for an error code, false if there isn't one
+bool isFatalError(RETURNCODE); //true for the errors that still end the whole line rather than just failing the command
+
+/*struct to hold one entry of the persistent history
+* each is written to the history file as one line: "time status duration command" */
+struct historyRecord
+{
+    time_t time;  //when the command started
+    int status;  //0 if it succeeded
+    double duration;  //seconds, from reading the line to the command finishing (or starting, for background jobs)
+    std::string command;
+};
+
+/*struct to hold one slot of the in-memory history ring
+* the command itself is interned in Shell::historyStrings, so a command that is repeated doesn't allocate anything */
+struct historySlot
+{
+    int number;  //the command number shown in the prompt when it was entered, which is what ! uses
+    time_t time;
+    int status;
+    double duration;
+    const std::string* command;
+};
+
+/*struct to hold details for each process in a job
+* everything except the pid, pidfd and cmd is filled in by Shell::recordProcessEnd once the process is reaped
+* internal commands in an @ chain have no process, so their pid is 0 */
+struct bgProcess
+{
+    pid_t pid;
+    int pidfd; //refers to this exact process even if the pid is reused, -1 once it has been reaped (or if pidfd_open isn't available)
+    std::string cmd; //just this command of the @ chain
+    bool finished;
+    int status;
+    time_t endTime;
+    struct timespec endClock; //CLOCK_MONOTONIC, for the wall time
+    struct rusage usage;
+    
+    bgProcess(pid_t p): pid(p), pidfd(-1), finished(false), status(0), endTime(0), endClock(), usage() {}
+};
+
+/*struct to hold details for each job
+* background jobs live in bgJobQueue until they finish, and every finished job, foreground or background, is kept in jobStatsList for the jobstats command
+* foreground jobs have a jobID of 0 */
 struct bgJob
 {
     int jobID;
-    std::vector<pid_t> pidList;
+    std::vector<bgProcess> processList; //one per command in the @ chain, in order
     std::string cmd;
     time_t startTime;
+    struct timespec startClock; //CLOCK_MONOTONIC, taken just before the first command was started
+    int runningCount; //how many of processList haven't been reaped yet
+    pid_t pgid; //the job's own process group, 0 if it doesn't have one (without job control, or for parallel)
+    bool stopped; //set when one of its processes is stopped, eg by ctrl-z, until it is continued
     
-    bgJob(int i, std::vector<pid_t> p, std::string c, time_t t): jobID(i), pidList(p), cmd(c), startTime(t){}
+    bgJob(int i, std::vector<pid_t> p, std::string c, time_t t, struct timespec clk, pid_t g): jobID(i), processList(p.begin(), p.end()), cmd(c), startTime(t), startClock(clk), runningCount((int) p.size()), pgid(g), stopped(false) {}
 };
 
 /*info for the man command when applied to internal commands
 * since these are simple commands, I'm just putting the strings here rather than having an actual file */
-const std::string NEWNAMEINFO = "newname usage:\nnewname alias [argument]\nAdds or deletes an alias.  The first argument is the name of the alias and the second is an optional value.\nIf one argument is included, that alias will be deleted from the alias list.  If two arguments are included, the first is inserted into the list as an alias for the second\n";
+const std::string NEWNAMEINFO = "newname usage:\nnewname alias [argument]\nAdds or deletes an alias.  The first argument is the name of the alias and the second is an optional value.\nIf one argument is included, that alias will be deleted from the alias list.  If two arguments are included, the first is inserted into the list as an alias for the second.\nAn alias that would end up expanding to itself, directly or through other aliases, is rejected\n";
 const std::string FRONTJOBINFO = "frontjob usage:\nfrontjob jobID\nBrings a background job to the foreground.\njobID must be an integer.  Use the backjobs command to get the jobIDs of current background jobs\n";
 const std::string BACKJOBINFO = "backjobs usage:\nbackjobs\nPrints status info about current background jobs.  Accepts no arguments\n";
+const std::string BGINFO = "bg usage:\nbg jobID\nContinues a stopped job (eg one stopped with ctrl-z) in the background.\njobID must be an integer.  Use the backjobs command to get the jobIDs of current background jobs\n";
 const std::string CONDINFO = "cond and notcond usage:\n[not]cond ( condition filename ) command\nConditionally executes a command.  If cond is used, the condition must evaluate to true for the command to execute.  If notcond is used, the condition must evaluate to false for the command to execute.\nAccepts the following formats:\n[not]cond ( condition filename ) command\n[not]cond (condition filename) command\n[not]cond condition filename command\nAcceptable conditions are checke, checkd, checkr, checkw and checkx\n";
-const std::string SAVEALIASINFO = "savenewnames usage:\nsavenewnames filename\nSaves the current alias list to the given file.  If file does not exist, it will be created\n";
-const std::string READALIASINFO = "readnewnames usage:\nreadnewnames file\nReads the specified file into the alias list, updating any with new values and adding any new aliases.  Does not delete any other aliases in the current list.\nFile must exist and be readable\n";
-const std::string HISTORYINFO = "history usage:\nhistory\nPrints the last 10 commands entered at the command line.  Accepts no arguments\n";
+const std::string SAVEALIASINFO = "savenewnames usage:\nsavenewnames [-b] filename\nSaves the current alias list to the given file.  If file does not exist, it will be created\nWith -b, saves a binary snapshot instead, which readnewnames loads without any tokenizing\n";
+const std::string READALIASINFO = "readnewnames usage:\nreadnewnames file\nReads the specified file into the alias list, updating any with new values and adding any new aliases.  Does not delete any other aliases in the current list.\nFile must exist and be readable, and can be text or a binary snapshot from savenewnames -b.  The whole file is checked before anything is added, so if any line is bad (the line number is printed), the alias list is left as it was\n";
+const std::string HISTORYINFO = "history usage:\nhistory [-s pattern | -p prefix]\nPrints the last 10 commands entered at the command line this session, numbered as in the prompt, with when they ran, their exit status and how long they took.\nHistory is also kept in ~/.toyshell_history, so it includes earlier sessions.  -s prints every command in that file containing pattern, -p every command starting with prefix, numbered #1 onwards\n";
 const std::string SETSHELLINFO = "setshellname usage:\nsetshellname name\nSets the shell name.  Also saves this value to config.ini so it is maintained between sessions.  Only accepts one argument.\n";
 const std::string SETDELIMINFO = "setterminator usage:\nsetterminator delim\nSets the shell delimiter.  Also saves this value to config.ini, so it maintained between sessions.  Only accepts one argument.\n";
 const std::string PRINTALIASINFO = "newnames usage:\nnewnames\nPrints the current alias list.  Accepts no arguments\n";
-const std::string REPLACEHISTINFO = "! usage:\n! arg\nReruns the line of history specified by arg.  Arg must be numeric\n";
+const std::string USESCRIPTINFO = "usescript usage:\nusescript [-j N [-k]] filename\nReads a list of commands from the given file and runs them in order.\nWith -j, up to N linux commands from the script run at the same time and their output is printed as each finishes, or in script order if -k is given.  Internal commands in a -j script wait for everything before them to finish\n";
+const std::string SCRIPTCACHEINFO = "scriptcache usage:\nscriptcache [clear | save filename]\nScripts run with usescript are compiled the first time they run, and later runs skip the parsing as long as the file hasn't changed.\nWith no arguments, lists the compiled scripts.  clear forgets them.  save compiles the script and writes it to filename.tshc, where usescript finds it even in a new shell\n";
+const std::string SETALIASSIZEINFO = "setaliassize usage:\nsetaliassize [size]\nSets how many aliases are kept.  Once the list is full, adding an alias forgets the one that was used least recently.\nWith no arguments, prints the current size and how many aliases are in the list\n";
+const std::string REPLACEHISTINFO = "! usage:\n! arg\nReruns the line of history specified by arg.  Arg must be numeric, and is the command number shown in the prompt.\nWith a # in front (eg ! #120), reruns that entry of the history file instead, as numbered by history -s and -p\n";
+const std::string SETHISTORYSIZEINFO = "sethistorysize usage:\nsethistorysize [size]\nSets how many commands this session's history keeps, keeping the most recent ones.  With no arguments, prints the current size\n";
+const std::string SETLAUNCHERINFO = "setlauncher usage:\nsetlauncher spawn|fork\nSelects how linux commands are started.  spawn uses posix_spawn, which doesn't copy the shell's memory and is the default.  fork uses fork and exec.\nCommands that can't be spawned are always started with fork.  Only accepts one argument.\n";
+const std::string TRANSFERINFO = "transfer usage:\ntransfer, optionally followed by [ infile and/or ] outfile\nCopies its input to its output without the data ever passing through a user space buffer, using copy_file_range, splice or sendfile depending on whether each end is a file or a pipe.\nCan be used on its own or as any command in an @ chain, eg \"transfer [ big.log @ grep error\".  Accepts no other arguments.\n";
+const std::string JOBSTATSINFO = "jobstats usage:\njobstats\nPrints the exit code, wall time, user and system CPU time and maximum resident size of every command in the last 20 finished jobs, foreground or background.\nForeground jobs are shown with job fg.  Accepts no arguments\n";
+const std::string PARALLELINFO = "parallel usage:\nparallel [-k] N command [args] ::: arg1 arg2 ...\nRuns the command once for every argument after :::, with at most N of them running at the same time.  Any {} in the command is replaced by the argument, otherwise the argument is added to the end.\nThe output of each command is collected and printed once it finishes, or in the original order if -k is given.\nA whole script can be run the same way with usescript -j N [-k] filename\n";
+const std::string SETUTILITIESINFO = "setutilities usage:\nsetutilities shell|linux\nWith shell (the default), echo, cat, true, false, test and printf are run by the shell itself whenever they are a whole command on their own in the foreground, saving a process launch.\nlinux always runs the real programs instead.  Only accepts one argument.\n";
+const std::string HASHINFO = "hash usage:\nhash [-r] [command ...]\nWith no arguments, prints the remembered full paths of linux commands.  With command names, looks each one up in $PATH and remembers it.\n-r forgets all remembered paths.  The table is also cleared automatically whenever $PATH changes\n";
 
 
-class Shell
+class Shell;
+
+/*struct to hold one entry of the builtin table
+* function is NULL for names that only have help text, like cond, which are handled by parseCommandTree rather than run
+* minArgs and maxArgs count the words after the command name, and are checked before the command runs, -1 means no limit */
+struct builtinCommand
+{
+    std::string_view name;
+    void (*function)(Shell*);
+    const std::string* info;  //shown by man, NULL if there is none, in which case man passes the name on to linux
+    int minArgs;
+    int maxArgs;
+    bool pipeStage;  //true if it can be a command of an @ chain, where it runs on a helper thread with its output going down the pipe
+};
+
+/*struct to hold one of the small linux utilities the shell can run itself
+* function gets the words (including the command name) and the fds to use for stdin and stdout, and returns the exit status,
+* or -1 before doing anything if it was given options it doesn't handle, so the real program gets run instead */
+struct utilityCommand
+{
+    std::string_view name;
+    int (*function)(Shell*, const std::deque<std::string>&, int, int);
+};
+
+/*struct to hold the lexer's output for one line
+* arena holds every word with its quotes and escapes removed, and tokens holds a view of each word in arena
+* text is the line as the user typed it, minus any comment and extra blanks, but with the quoting kept, for history and job listings */
+struct lexedLine
+{
+    std::string text;
+    std::string arena;
+    std::vector<std::string_view> tokens;
+    std::vector<bool> quoted;  //true for a word that had any quotes or backslashes in it
+};
+
+/*struct to hold one command of an @ chain, along with the files from any [ or ] that belong to it (empty if none) */
+struct commandStage
+{
+    std::deque<std::string> words;
+    std::vector<int> statusWords;  //positions in words of any unquoted $?, which are replaced with the last exit status as the command starts
+    std::string inputFile;
+    std::string outputFile;
+    int utility;  //index in the utility table if the command is one the shell can run itself, -1 otherwise
+    const builtinCommand* builtin;  //the builtin table entry if the command is an internal one that can run as a stage, NULL otherwise
+    
+    commandStage(): utility(-1), builtin(NULL) {}
+};
+
+/*struct to hold an internal command that is running as one of the commands of an @ chain
+* the helper thread fills in status and usage once the command returns, and failure if it threw */
+struct builtinStage
+{
+    int index;  //which command of the @ chain it is
+    const builtinCommand* builtin;
+    std::deque<std::string> words;  //with any $? already filled in
+    int outFD;  //the helper thread's own copy of the command's stdout, closed as soon as the command is done
+    int status;
+    struct rusage usage;
+    std::exception_ptr failure;
+};
+
+/*stream buffer that writes straight to a file descriptor
+* std::cout is pointed at one of these while an internal command runs as a stage of an @ chain */
+class fdStreamBuffer : public std::streambuf
 {
+public:
+    fdStreamBuffer(int);
+    ~fdStreamBuffer();
+    
+protected:
+    int overflow(int);
+    int sync();
+    
 private:
-    //defines a "string to function address" pair
-    typedef std::pair<std::string, void(*)(Shell*)> functionPair; //used in the map later, to improve readability
+    int fd;
+    char buffer[STAGE_BUFFER_SIZE];
+};
+
+/*struct to hold one cond or notcond in front of a command */
+struct condGuard
+{
+    bool negated;  //true for notcond
+    std::string condition;  //checke, checkd, checkr, checkw or checkx
+    std::string file;
+    
+    condGuard(): negated(false) {}
+};
+
+/*struct to hold a whole command line once it has been parsed, ready to run
+* built once by parseCommandTree and only read from then on, so the executors walk it instead of rebuilding tokenList
+* stages are only split for linux commands and transfer, and not until the first time they are needed */
+struct commandTree
+{
+    std::string connector;  //the ; && or || joining this command to the one before it, empty for the first command of a line
+    std::vector<condGuard> guards;  //all of these must hold for the command to run
+    std::deque<std::string> words;  //after alias substitution and removing the guards and the background operator
+    std::deque<bool> quoted;
+    bool background;
+    const builtinCommand* builtin;  //the entry in the builtin table, NULL for linux commands
+    void (*function)(Shell*);  //the resolved command
+    bool stagesSplit;
+    std::vector<commandStage> stages;
+    
+    commandTree(): background(false), builtin(NULL), function(NULL), stagesSplit(false) {}
+};
+
+/*struct to hold every command of a line, in the order they appear
+* a line without any ; && or || is just a list of one */
+struct commandList
+{
+    std::vector<commandTree> commands;
+};
+
+/*struct to hold one line of a script in its compiled form, so running it again skips the parsing
+* raw, text and tokens only depend on the file, so they are filled in once when the line is first read
+* list depends on the alias list, so it is built when the line first runs, and again whenever aliasGeneration shows the aliases have changed */
+struct compiledLine
+{
+    std::string raw;  //exactly as it appears in the file, for the echo
+    std::string text;  //without comments or extra spaces, what currentLine would be
+    std::deque<std::string> tokens;  //before alias substitution
+    std::deque<bool> quoted;
+    bool compiled;  //false for blank lines and ! lines, which always go through the normal path
+    
+    long aliasGeneration;  //-1 until the line has run
+    commandList list;
     
-    std::map<std::string, void(*)(Shell*)> commandMap; //maps from the command to the address of the function to run
+    compiledLine(): compiled(false), aliasGeneration(-1) {}
+};
+
+/*struct to hold a whole script in its compiled form, along with the modification time and size it was compiled from */
+struct compiledScript
+{
+    std::string name;
+    struct timespec mtime;
+    off_t size;
+    std::deque<compiledLine> lines;  //deque so that adding lines while the script is first read doesn't move the earlier ones
+    bool complete;  //false while the first run is still reading the file
+    
+    compiledScript(): mtime(), size(0), complete(false) {}
+};
+
+/*struct to hold each script being run by usescript
+* scripts are read one line at a time as they run, rather than loaded into memory first
+* device and inode identify the file for the recursion check, so the same script can't sneak in under a different name */
+struct scriptFile
+{
+    std::string name;
+    dev_t device;
+    ino_t inode;
+    std::vector<char> buffer;
+    std::ifstream file;
+    compiledScript* cache;  //the script's entry in the script cache, NULL if it is too long to cache
+    bool recording;  //true if the file is being read and each line added to cache, false if the lines come from cache
+    size_t nextLine;  //next line of cache to run when not recording
+    
+    scriptFile(std::string n, dev_t d, ino_t i): name(n), device(d), inode(i), buffer(SCRIPT_BUFFER_SIZE), cache(NULL), recording(false), nextLine(0) {}
+};
+
+/*struct to hold one command of a parallel run (see Shell::runParallel) */
+struct parallelTask
+{
+    std::string line;
+    int outputFD; //memfd that collects the command's stdout until it gets printed, -1 if there is none
+    bool finished;
+    bool failed;
+    bool printed;
+    
+    parallelTask(std::string l): line(l), outputFD(-1), finished(false), failed(false), printed(false) {}
+};
+
+class Shell
+{
+private:
+    //every internal command, with the address of the function to run, its help text and how many arguments it takes
+    //builtinSlots maps a hash of the name to the entry's index (-1 for an empty slot), and builtinSeed is chosen so no two names share a slot
+    //all three are worked out at compile time, so finding a command is one hash and one compare
+    static const builtinCommand builtinTable[BUILTIN_COUNT];
+    static const uint32_t builtinSeed;
+    static const std::array<signed char, BUILTIN_SLOTS> builtinSlots;
     void (*functionPointer)(Shell*); //declaring a function pointer with a Shell pointer parameter
     
     std::string shellName;
     std::string shellDelimiter;
     int commandCount;
     
+    //each alias is a deque with the key at [0] and the value after it
+    //aliasList keeps them from least to most recently used, and aliasIndex finds one by key without searching the list
+    typedef std::list<std::deque<std::string>>::iterator aliasIterator;
+    
     int maxAliasSize, maxHistorySize;
-    std::deque<std::deque<std:: string>> aliasList;
-    std::deque<std::string> historyList;
+    std::list<std::deque<std::string>> aliasList;
+    std::unordered_map<std::string, aliasIterator> aliasIndex;
+    //the aliases form a dependency graph, with an edge from each alias to every token of its value
+    //aliasExpansions remembers each alias fully expanded, and aliasDependents maps a token to the aliases whose value uses it,
+    //so changing one alias only throws away the expansions that went through it
+    std::unordered_map<std::string, std::deque<std::string>> aliasExpansions;
+    std::unordered_map<std::string, std::set<std::string>> aliasDependents;
+    //the history file is only appended to, and only read (through a read-only mapping) when history or ! need it
+    //historyOffsets is where each entry starts, so entry n can be found without reading the ones before it
+    //historyPrefixOrder holds entry numbers sorted by command, so a prefix search is a binary search (built on the first one)
+    std::string historyFileName;
+    int historyFD;
+    char* historyMap;
+    size_t historyMapSize;
+    size_t historyIndexedSize;
+    std::vector<off_t> historyOffsets;
+    std::vector<size_t> historyPrefixOrder;
+    bool historyPending; //true while a typed command is running, so run() knows to write its entry when it finishes
+    historyRecord pendingHistory;
+    int pendingHistoryNumber;
+    //this session's history is also kept in a ring of maxHistorySize slots, allocated once, with historyHead the oldest
+    //historyStrings holds each distinct command once, with how many slots are using it
+    std::vector<historySlot> historyRing;
+    size_t historyHead, historyCount;
+    std::unordered_map<std::string, int> historyStrings;
+    struct timespec historyClock;
     bool NOHISTORYFLAG;
     std::string currentLine;  //the current command, including pipes and redirection, but with no leading or trailing spaces
+    lexedLine lexed;  //the lexer's output for the current line, reused so the lexer doesn't allocate once it has grown to fit the longest line (setTokens still copies the words out)
+    std::deque<bool> tokenQuoted;  //whether each token in tokenList had any quoting, so a quoted [ ] @ or - isn't taken as an operator
     std::deque<std::string> tokenList;
     
-    std::deque<std::deque<std::string>> childSubCommands; //used for linux piping
+    commandList lineList; //the parsed form of a typed line, reused from line to line
+    commandTree* currentTree; //the tree of the command being run, so runLinuxCommand and transfer can get at its stages
+    std::vector<int> stageInputFDs, stageOutputFDs; //files opened by openRedirectionFiles for [ and ], one entry per stage, -1 if that stage has none
+    bool spawnMode; //true if linux commands are started with posix_spawn, false for fork
+    bool utilityMode; //true if the commands in utilityTable are run by the shell when they can be, false to always run the real programs
+    static const utilityCommand utilityTable[UTILITY_COUNT];
+    std::vector<builtinStage> builtinStages; //the internal commands of the @ chain launchPipeline last started, run in order by stageWorker
+    std::thread stageWorker;
+    bool runningAsStage; //true while stageWorker is running internal commands, which then leave reaping to the main thread
     
     bool backgroundMode;
+    int exitStatus; //exit status of the last command run, what $? is replaced with
+    std::string statusText; //exitStatus as it was when the current command started, as a string for $?
+    bool stopRequested; //set by stop, or at the end of the input, so run() can tell main to exit once the line is finished
+    //batch mode reads its commands from batchFD (a script or piped stdin) in large blocks, or from a -c string already in batchBuffer,
+    //without prompts, script echo, history or config.ini
+    bool batchMode;
+    int batchFD; //-1 once everything has been read, and from the start for -c
+    std::vector<char> batchBuffer;
+    size_t batchStart, batchEnd; //the part of batchBuffer that hasn't been read yet
     int bgJobCount;
     std::map<int, bgJob> bgJobQueue; //holds all jobs currently running in the background
+    std::deque<bgJob> jobStatsList; //the last JOB_STATS_SIZE finished jobs, oldest first
+    static int sigchldPipe[2]; //self-pipe, the SIGCHLD handler writes a byte to [1] so the shell knows there is something to reap
+    bool childSignalled; //set whenever a wait empties the self-pipe, so reapChildren still checks the background jobs for stops
+    //with job control (an interactive shell on a terminal) every job gets its own process group, and the foreground one gets the terminal
+    bool jobControl;
+    pid_t shellPGID;
+    struct termios shellModes; //the terminal settings to go back to once a foreground job is done with the terminal
     
-    std::deque<std::deque<std::string>> scriptStack; //stack of queues that holds any currently executing scripts
+    std::deque<std::unique_ptr<scriptFile>> scriptStack; //stack of currently executing scripts, the front is the one being read
+    std::set<std::pair<dev_t, ino_t>> openScripts; //identities of every script being run, including ones run by usescript -j which don't go through scriptStack
+    std::map<std::pair<dev_t, ino_t>, compiledScript> scriptCache; //compiled scripts, keyed by the identity of the file
+    compiledLine* currentCompiled; //the compiled form of the current line if it came from the script cache, NULL otherwise
+    long aliasGeneration; //incremented whenever the alias list changes, so compiled lines know to redo their alias substitution
     
-    std::map<std::string, std::string> infoMap;
+    //command name -> full path, filled in the parent on first use so children don't have to search $PATH themselves
+    std::unordered_map<std::string, std::string> commandHashTable;
+    std::string hashedPathVar; //value of $PATH when the table was filled, table is cleared if it no longer matches
     
     //COMMAND FUNCTIONS
     //declaring all as static because it makes my function pointer mapping method significantly easier
@@ -106,14 +449,29 @@ private:
     static void staticExit(Shell*);
     static void staticPrintBGJobs(Shell*);
     static void staticBringJobToFG(Shell*);
-    static void staticCondExec(Shell*);
-    static void staticReverseCondExec(Shell*);
+    static void staticContinueJob(Shell*);
     static void staticCull(Shell*);
     static void staticUsescript(Shell*);
     static void staticOutput(Shell*);
+    static void staticHashCommand(Shell*);
+    static void staticSetLauncher(Shell*);
+    static void staticTransfer(Shell*);
+    static void staticPrintJobStats(Shell*);
+    static void staticParallel(Shell*);
+    static void staticScriptCacheCommand(Shell*);
+    static void staticSetAliasSize(Shell*);
+    static void staticSetHistorySize(Shell*);
+    static void staticSetUtilities(Shell*);
+    static int echoUtility(Shell*, const std::deque<std::string>&, int, int);
+    static int catUtility(Shell*, const std::deque<std::string>&, int, int);
+    static int trueUtility(Shell*, const std::deque<std::string>&, int, int);
+    static int falseUtility(Shell*, const std::deque<std::string>&, int, int);
+    static int testUtility(Shell*, const std::deque<std::string>&, int, int);
+    static int printfUtility(Shell*, const std::deque<std::string>&, int, int);
     
     void setShellName();
     void setShellDelimiter();
+    void saveConfig(); //writes the shell name and delimiter to config.ini, except in batch mode
     void printHistory();
     void printAliases();
     void newnameCommand();
@@ -121,39 +479,114 @@ private:
     void addNewAlias();
     void saveNewAliasFile();
     void readAliasFile();
-    void runChildProcess(int);
+    void runChildProcess(const commandStage&, std::string);
+    pid_t launchChild(const commandStage&, std::string, int, int, pid_t);
+    std::vector<pid_t> launchPipeline(commandTree&, int, struct timespec&, pid_t&);
     void runLinuxCommand();
     void infoCommand();
     void exit();
     void printBGJobs();
     void bringJobToFG();
-    void condExec();
-    void reverseCondExec();
+    void continueJob();
     void cull();
     void usescript();
     void output();
+    void hashCommand();
+    void setLauncher();
+    void setUtilities();
+    void transfer();
+    void printJobStats();
+    void parallel();
+    void scriptCacheCommand();
+    void setAliasSize();
+    void setHistorySize();
     
     //HELPER FUNCTIONS
     void replaceWithHistory();  //the ! # command is special; because it requires substitution of a command from history before following the regular tokenize -> interpret -> execute structure, it is implemented seperate from the other command functions, and runs immediately after reading the input line
-    void tokenizeString(std::string, std::deque<std::string>*);
-    void parseRedirection();
+    void openRedirectionFiles(const commandTree&);
+    void splitStages(commandTree&);
+    void closeRedirectionFiles();
     void parseCommandLineWhitespace(); //used to remove leading whitespace from command
-    void addJobToBGQueue(std::vector<pid_t>);
-    int condChecker(); //evaluates conditions, passes back to either cond or reverseCondExec
+    bgJob createJob(int, const commandTree&, std::vector<pid_t>, struct timespec, pid_t);
+    void addJobToBGQueue(const commandTree&, std::vector<pid_t>, struct timespec, pid_t);
+    void addStoppedJob(bgJob&); //moves a foreground job that was stopped into bgJobQueue
+    void addJobToStats(const bgJob&);
+    int parseGuard(int, condGuard&); //reads a cond or notcond starting at tokenList[i], returns how many tokens it used
+    bool checkGuard(const condGuard&);
+    static const builtinCommand* findBuiltin(std::string_view); //returns the builtin table entry for a name, or NULL if there isn't one
+    bool isReservedName(std::string); //true for every name in the builtin table, including cond and notcond, which can't be aliases
+    static void sigchldHandler(int);
+    void reapChildren(); //collects every finished child and prints a notice for each finished background job
+    void recordProcessEnd(bgJob&, int, int, const struct rusage&);
+    bool collectProcess(bgJob&, int); //collects an exit, stop or continue of one process without blocking, false if nothing has happened to it
+    void collectBackgroundExits(); //records every background process that has exited, without printing anything
+    void waitForInput(); //waits for a line on stdin, collecting background exits while it waits
+    void waitForProcesses(const std::vector<bgJob*>&, int); //polls the pidfds of the jobs for up to the timeout, then collects whatever changed
+    bool waitForJob(bgJob&, bool); //runs a job in the foreground until it finishes or stops, true if it stopped
+    void signalJob(bgJob&, int);
+    std::string findCommandPath(std::string); //resolves a command name through the hash table, searching $PATH on a miss
+    bool transferData(int, int); //moves everything from the first fd to the second inside the kernel, used by the transfer stage
+    static int findUtility(std::string_view); //returns the index in utilityTable, or -1
+    bool runUtility(commandTree&); //runs a single stage utility inside the shell, false if it has to be run as a real program after all
+    void runBuiltinStages(); //body of stageWorker
+    std::exception_ptr finishBuiltinStages(bgJob&); //waits for stageWorker and records how its commands ended in the job
+    int parseSlotCount(std::string); //validates the N of parallel and usescript -j
+    int jobExitStatus(const bgJob&);
+    void buildArgv(const commandStage&, std::vector<char*>&); //points argv at the stage's words, with $? filled in
+    void runParallel(std::deque<std::string>, int, bool, bool);
+    void printParallelTask(parallelTask&, bool);
+    void popScript(); //closes the script at the front of scriptStack
+    void clearScripts(); //closes every script in scriptStack
+    bool readScriptLine(scriptFile&); //reads the next line of a script from the file or the script cache
+    bool readBatchLine(std::string&); //reads the next line of batch input, false once there is none left
+    compiledLine compileLine(std::string);
+    compiledScript* findCompiledScript(std::string, const struct stat&);
+    bool writeCompiledScript(std::string, const compiledScript&);
+    bool loadCompiledScript(std::string, const struct stat&, compiledScript&);
+    void runCompiledLine();
     
 public:
     //INITLIAZATION FUNCTIONS
     //set up variables, default values
-    Shell(std::string, std::string, int, int);
+    Shell(std::string, std::string, int, int, bool);
+    void setBatchInput(int); //batch mode reads from this file descriptor
+    void setBatchCommand(std::string); //batch mode runs these commands, as given to -c
+    int getExitStatus();
     
     //MAIN PROGRAM FUNCTIONS
-    void run();  //main driver
+    bool run();  //main driver, returns false once the shell should exit
     void printCommandLine();  //prints toyshell[1]>
     bool readCommandLine();  //reads input
     void parseCommandLine();  //checks for input errors, tokenizes the input string
-    void parseAliases();  //loops through the input string, replaces all aliases, checks for recursive aliasing
+    void setTokens(); //copies the lexer's words into tokenList, and whether each was quoted into tokenQuoted
+    bool tokenIsQuoted(int);
+    bool isOperator(int, std::string); //true if token i is op, and wasn't quoted
+    void useAlias(aliasIterator); //moves the alias to the most recently used end of aliasList
+    void trimAliasList(int); //drops least recently used aliases until there are at most that many
+    void removeAlias(aliasIterator); //takes an alias out of aliasList, aliasIndex and the dependency graph
+    void linkAlias(const std::deque<std::string>&); //adds an alias's edges to the dependency graph
+    void invalidateAlias(std::string); //forgets the expansions of an alias and everything that depends on it
+    bool aliasReaches(std::string, std::string, std::set<std::string>&); //true if expanding the first would need the second
+    const std::deque<std::string>& expandAlias(std::string);
+    bool parseAliasSnapshot(const char*, size_t, std::vector<std::deque<std::string>>&); //reads a binary snapshot written by savenewnames -b
+    void commitAliases(const std::vector<std::deque<std::string>>&, const std::vector<int>&, std::string); //validates a whole set of aliases and adds them all at once
+    bool openHistoryFile();
+    void indexHistory(); //adds any entries appended since the last call to historyOffsets
+    void sortHistoryPrefixes();
+    const char* historyCommand(size_t, size_t&); //returns where entry n's command starts in historyMap, and its length
+    historyRecord readHistoryEntry(size_t);
+    void printHistoryEntry(size_t);
+    void finishHistoryEntry(int); //appends the running command's entry to the history file and the history ring
+    void pushHistorySlot(int, const historyRecord&);
+    void releaseHistoryString(const std::string*); //drops a slot's use of an interned command, freeing it once nothing uses it
+    const historySlot* findHistorySlot(int); //returns the slot for a command number, or NULL if it isn't in the ring
+    void printHistorySlot(const historySlot&);
+    void parseAliases();  //loops through the input string, replaces all aliases with their expansions
     void addCommandToHistory();
-    void execCommand();  //selects the right command to run
+    void parseCommandTree(commandTree&);  //turns tokenList into a command tree, shared by typed, compiled and parallel lines
+    void runCommandTree(commandTree&);  //checks the guards and runs the command
+    void parseCommandList(commandList&);  //splits tokenList at ; && and || and builds a tree for each part
+    void runCommandList(commandList&);
     void reset(); //clears the token queue before the next command
 };
 